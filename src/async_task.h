@@ -31,6 +31,8 @@ public:
     virtual ~AsyncTaskBase() {}
 
     virtual bool cancel() = 0;
+
+    virtual bool cancelled() const noexcept = 0;
 };
 
 
@@ -81,8 +83,23 @@ public:
         return *status_ != TaskStatus::pending;
     }
 
-    inline bool cancelled() const noexcept {
-        return *status_ == TaskStatus::cancelled;
+    // Task is also treated as cancelled when its consumer is cancelled or destroyed,
+    // so long running work can be aborted when nobody waits for the result.
+    inline bool cancelled() const noexcept override {
+        if (*status_ == TaskStatus::cancelled) {
+            return true;
+        }
+        if (!has_consumer_) {
+            return false;
+        }
+        auto consumer = consumer_.lock();
+        return !consumer || consumer->cancelled();
+    }
+
+    // Should be set before task is passed to other threads
+    inline void SetConsumer(std::weak_ptr<const AsyncTaskBase> consumer) noexcept {
+        consumer_ = std::move(consumer);
+        has_consumer_ = true;
     }
 
     inline bool cancel() noexcept override {
@@ -151,5 +168,7 @@ private:
     result_cb_t success_callback_;
     error_cb_t error_callback_;
     std::shared_ptr<std::atomic<TaskStatus>> status_;
+    std::weak_ptr<const AsyncTaskBase> consumer_;
     folly::EventBase* evb_{nullptr};
+    bool has_consumer_{false};
 };
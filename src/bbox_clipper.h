@@ -1,6 +1,9 @@
 #ifndef CPPOPNIK_BBOX_CLIPPER_H
 #define CPPOPNIK_BBOX_CLIPPER_H
 
+#include <algorithm>
+#include <vector>
+
 #include <mapnik/box2d.hpp>
 #include <mapnik/geometry.hpp>
 
@@ -160,6 +163,156 @@ inline point<T> GetTurningPoint(uint8_t maillon_outcode, const mapnik::box2d<T>&
     return result;
 }
 
+// Sutherland-Hodgman clipping of ring points (without closing point) by one side of box
+template <typename T, typename Inside, typename Intersect>
+inline void ClipRingSide(const linear_ring<T>& input, linear_ring<T>* output, Inside inside, Intersect intersect) {
+    output->clear();
+    if (input.empty()) {
+        return;
+    }
+    const point<T>* prev = &input.back();
+    bool prev_inside = inside(*prev);
+    for (const auto& cur : input) {
+        const bool cur_inside = inside(cur);
+        if (cur_inside != prev_inside) {
+            output->push_back(intersect(*prev, cur));
+        }
+        if (cur_inside) {
+            output->push_back(cur);
+        }
+        prev = &cur;
+        prev_inside = cur_inside;
+    }
+}
+
+// Clips closed ring by box. Parts of ring outside of box are replaced by box border, so ring leaving and
+// entering box several times gets degenerate edges along the border. Holes crossing the box come out
+// touching the exterior ring along the border, which is not valid OGC output (renderers fill it fine).
+// Ring should not be self-intersecting. Output is closed, empty if ring is outside of box.
+template <typename T>
+inline void ClipRing(const linear_ring<T>& ring, const mapnik::box2d<T>& bbox, linear_ring<T>* output) {
+    linear_ring<T> buffer;
+    buffer.assign(ring.begin(), ring.end());
+    if (buffer.size() > 1 && buffer.front() == buffer.back()) {
+        buffer.pop_back();
+    }
+    // Intersections are computed for segments crossing the side, so there is no division by zero
+    ClipRingSide(buffer, output, [&bbox](const point<T>& p) { return p.x >= bbox.minx(); },
+                 [&bbox](const point<T>& p0, const point<T>& p1) {
+        return point<T>(bbox.minx(), p0.y + (p1.y - p0.y) * (bbox.minx() - p0.x) / (p1.x - p0.x));
+    });
+    ClipRingSide(*output, &buffer, [&bbox](const point<T>& p) { return p.x <= bbox.maxx(); },
+                 [&bbox](const point<T>& p0, const point<T>& p1) {
+        return point<T>(bbox.maxx(), p0.y + (p1.y - p0.y) * (bbox.maxx() - p0.x) / (p1.x - p0.x));
+    });
+    ClipRingSide(buffer, output, [&bbox](const point<T>& p) { return p.y >= bbox.miny(); },
+                 [&bbox](const point<T>& p0, const point<T>& p1) {
+        return point<T>(p0.x + (p1.x - p0.x) * (bbox.miny() - p0.y) / (p1.y - p0.y), bbox.miny());
+    });
+    ClipRingSide(*output, &buffer, [&bbox](const point<T>& p) { return p.y <= bbox.maxy(); },
+                 [&bbox](const point<T>& p0, const point<T>& p1) {
+        return point<T>(p0.x + (p1.x - p0.x) * (bbox.maxy() - p0.y) / (p1.y - p0.y), bbox.maxy());
+    });
+    output->swap(buffer);
+    if (!output->empty()) {
+        output->push_back(output->front());
+    }
+}
+
+// Sign of cross product of (p1 - p0) and (p2 - p0)
+template <typename T>
+inline int Orientation(const point<T>& p0, const point<T>& p1, const point<T>& p2) {
+    const T cross = (p1.x - p0.x) * (p2.y - p0.y) - (p1.y - p0.y) * (p2.x - p0.x);
+    return (cross > 0) - (cross < 0);
+}
+
+// Point p is collinear with segment p0-p1, checks if it lies on the segment
+template <typename T>
+inline bool OnSegment(const point<T>& p0, const point<T>& p1, const point<T>& p) {
+    return std::min(p0.x, p1.x) <= p.x && p.x <= std::max(p0.x, p1.x) &&
+           std::min(p0.y, p1.y) <= p.y && p.y <= std::max(p0.y, p1.y);
+}
+
+// Segments intersect or touch each other
+template <typename T>
+inline bool SegmentsIntersect(const point<T>& p0, const point<T>& p1, const point<T>& q0, const point<T>& q1) {
+    const int o0 = Orientation(p0, p1, q0);
+    const int o1 = Orientation(p0, p1, q1);
+    const int o2 = Orientation(q0, q1, p0);
+    const int o3 = Orientation(q0, q1, p1);
+    if (o0 != o1 && o2 != o3) {
+        return true;
+    }
+    return (o0 == 0 && OnSegment(p0, p1, q0)) || (o1 == 0 && OnSegment(p0, p1, q1)) ||
+           (o2 == 0 && OnSegment(q0, q1, p0)) || (o3 == 0 && OnSegment(q0, q1, p1));
+}
+
+// Checks that ring has no self-intersections, touching edges and spikes. Edges are swept by x,
+// so only edges with overlapping x ranges are tested against each other.
+template <typename T>
+inline bool IsSimpleRing(const linear_ring<T>& ring) {
+    std::vector<point<T>> points;
+    points.reserve(ring.size());
+    for (const auto& p : ring) {
+        if (points.empty() || !(points.back() == p)) {
+            points.push_back(p);
+        }
+    }
+    if (points.size() > 1 && points.front() == points.back()) {
+        points.pop_back();
+    }
+    const std::size_t num_edges = points.size();
+    if (num_edges < 3) {
+        return false;
+    }
+    auto edge_end = [&points, num_edges](std::size_t edge_i) -> const point<T>& {
+        return points[edge_i + 1 < num_edges ? edge_i + 1 : 0];
+    };
+    // Adjacent edges share a point, they should not fold back onto each other
+    for (std::size_t edge_i = 0; edge_i < num_edges; ++edge_i) {
+        const point<T>& p0 = points[edge_i];
+        const point<T>& p1 = edge_end(edge_i);
+        const point<T>& p2 = edge_end(edge_i + 1 < num_edges ? edge_i + 1 : 0);
+        if (Orientation(p0, p1, p2) == 0 &&
+                (p1.x - p0.x) * (p2.x - p1.x) + (p1.y - p0.y) * (p2.y - p1.y) < 0) {
+            return false;
+        }
+    }
+    std::vector<std::size_t> edges(num_edges);
+    for (std::size_t edge_i = 0; edge_i < num_edges; ++edge_i) {
+        edges[edge_i] = edge_i;
+    }
+    auto min_x = [&points, &edge_end](std::size_t edge_i) {
+        return std::min(points[edge_i].x, edge_end(edge_i).x);
+    };
+    auto max_x = [&points, &edge_end](std::size_t edge_i) {
+        return std::max(points[edge_i].x, edge_end(edge_i).x);
+    };
+    std::sort(edges.begin(), edges.end(), [&min_x](std::size_t lhs, std::size_t rhs) {
+        return min_x(lhs) < min_x(rhs);
+    });
+    std::vector<std::size_t> active;
+    for (std::size_t edge_i : edges) {
+        const T start_x = min_x(edge_i);
+        active.erase(std::remove_if(active.begin(), active.end(), [&max_x, start_x](std::size_t other_i) {
+            return max_x(other_i) < start_x;
+        }), active.end());
+        const point<T>& p0 = points[edge_i];
+        const point<T>& p1 = edge_end(edge_i);
+        for (std::size_t other_i : active) {
+            const std::size_t diff = edge_i > other_i ? edge_i - other_i : other_i - edge_i;
+            if (diff == 1 || diff == num_edges - 1) {
+                continue;
+            }
+            if (SegmentsIntersect(p0, p1, points[other_i], edge_end(other_i))) {
+                return false;
+            }
+        }
+        active.push_back(edge_i);
+    }
+    return true;
+}
+
 } // ns bbox_clipper
 
 #endif //CPPOPNIK_BBOX_CLIPPER_H
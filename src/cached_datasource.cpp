@@ -1,5 +1,7 @@
 #include "cached_datasource.h"
 
+constexpr std::size_t CahedDataSource::kMaxCachedQueries;
+
 CahedDataSource::CahedDataSource(mapnik::datasource_ptr ds)
     : datasource(mapnik::parameters()),
       p_datasource_(std::move(ds))
@@ -7,32 +9,71 @@ CahedDataSource::CahedDataSource(mapnik::datasource_ptr ds)
     assert(p_datasource_);
 }
 
+CahedDataSource::CahedDataSource(std::shared_ptr<const DecodedLayer> layer, const mapnik::box2d<double>& envelope)
+    : datasource(mapnik::parameters()),
+      decoded_layer_(std::move(layer)),
+      envelope_(envelope)
+{
+    assert(decoded_layer_);
+}
+
 mapnik::datasource::datasource_t CahedDataSource::type() const {
+    if (decoded_layer_) {
+        return mapnik::datasource::Vector;
+    }
     return p_datasource_->type();
 }
 
 boost::optional<mapnik::datasource_geometry_t> CahedDataSource::get_geometry_type() const {
+    if (decoded_layer_) {
+        return decoded_layer_->geometry_type();
+    }
     return p_datasource_->get_geometry_type();
 }
 
 mapnik::featureset_ptr CahedDataSource::features(mapnik::query const& q) const {
     const auto& q_bbox = q.get_bbox();
-    if (q_bbox != cached_bbox_) {
-        cached_bbox_ = q_bbox;
-        cached_features_ = std::make_shared<CachedFeatureset>(p_datasource_->features(q));
+    if (decoded_layer_) {
+        // Decoded features are already in memory, nothing to cache
+        return decoded_layer_->features(q_bbox);
     }
-    // Copy made to ensure that returning member shared_ptr will not reset it
-    return mapnik::featureset_ptr(cached_features_);
+
+    std::lock_guard<std::mutex> lock(cache_mux_);
+    for (auto itr = cached_queries_.rbegin(); itr != cached_queries_.rend(); ++itr) {
+        if (itr->bbox.contains(q_bbox)) {
+            return itr->features->features(q_bbox);
+        }
+    }
+
+    mapnik::query superset_q(q);
+    for (const mapnik::attribute_descriptor& attr : p_datasource_->get_descriptor().get_descriptors()) {
+        superset_q.add_property_name(attr.get_name());
+    }
+    auto features = DecodedLayer::FromFeatureset(p_datasource_->features(superset_q));
+    if (cached_queries_.size() == kMaxCachedQueries) {
+        cached_queries_.pop_front();
+    }
+    cached_queries_.push_back(CachedQuery{q_bbox, features});
+    return features->features(q_bbox);
 }
 
 mapnik::featureset_ptr CahedDataSource::features_at_point(mapnik::coord2d const& pt, double tol) const {
+    if (decoded_layer_) {
+        return decoded_layer_->features(mapnik::box2d<double>(pt.x - tol, pt.y - tol, pt.x + tol, pt.y + tol));
+    }
     return p_datasource_->features_at_point(pt, tol);
 }
 
 mapnik::box2d<double> CahedDataSource::envelope() const {
+    if (decoded_layer_) {
+        return envelope_;
+    }
     return p_datasource_->envelope();
 }
 
 mapnik::layer_descriptor CahedDataSource::get_descriptor() const {
+    if (decoded_layer_) {
+        return decoded_layer_->descriptor();
+    }
     return p_datasource_->get_descriptor();
 }
@@ -1,12 +1,21 @@
 #pragma once
 
+#include <deque>
+#include <mutex>
+
 #include <mapnik/datasource.hpp>
 
-#include "cached_featureset.h"
+#include "decoded_layer.h"
 
+// Datasource caching features of recent queries. Query is served from cache if its bbox is
+// contained in bbox of cached query. Features are cached with all attributes, so queries with
+// any attribute projection are served from the same cache entry.
+// When backed by decoded layer datasource holds no mutable state and can be shared between workers.
 class CahedDataSource : public mapnik::datasource {
 public:
     CahedDataSource(mapnik::datasource_ptr ds);
+    // Serves features of already decoded layer instead of querying datasource
+    CahedDataSource(std::shared_ptr<const DecodedLayer> layer, const mapnik::box2d<double>& envelope);
 
     datasource_t type() const override;
     boost::optional<mapnik::datasource_geometry_t> get_geometry_type() const override;
@@ -16,7 +25,17 @@ public:
     mapnik::layer_descriptor get_descriptor() const override;
 
 private:
+    static constexpr std::size_t kMaxCachedQueries = 8;
+
+    struct CachedQuery {
+        mapnik::box2d<double> bbox;
+        std::shared_ptr<const DecodedLayer> features;
+    };
+
     const mapnik::datasource_ptr p_datasource_;
-    mutable mapnik::box2d<double> cached_bbox_;
-    mutable mapnik::featureset_ptr cached_features_{nullptr};
+    const std::shared_ptr<const DecodedLayer> decoded_layer_;
+    const mapnik::box2d<double> envelope_;
+    // Most recent query last
+    mutable std::deque<CachedQuery> cached_queries_;
+    mutable std::mutex cache_mux_;
 };
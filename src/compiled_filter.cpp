@@ -0,0 +1,260 @@
+#include "compiled_filter.h"
+
+#include <algorithm>
+#include <map>
+#include <tuple>
+
+#include <glog/logging.h>
+#include <mapnik/attribute.hpp>
+#include <mapnik/expression_node.hpp>
+
+
+static const mapnik::value null_value{};
+
+
+// Operand of comparison: literal or attribute. Returns operand index, -1 if node is not an operand.
+struct operand_compiler {
+    std::vector<CompiledFilter::Operand>& operands;
+    std::vector<mapnik::value>& literals;
+    std::vector<std::string>& attributes;
+
+    // Equal operands share index, so equal predicates of merged rules are deduplicated
+    std::int64_t AddOperand(bool attribute, std::uint32_t index) {
+        for (std::size_t operand_i = 0; operand_i < operands.size(); ++operand_i) {
+            if (operands[operand_i].attribute == attribute && operands[operand_i].index == index) {
+                return operand_i;
+            }
+        }
+        operands.push_back({attribute, index});
+        return operands.size() - 1;
+    }
+
+    template <typename T>
+    std::int64_t AddLiteral(const T& val) {
+        const mapnik::value literal(val);
+        for (std::size_t literal_i = 0; literal_i < literals.size(); ++literal_i) {
+            if (literals[literal_i].which() == literal.which() && literals[literal_i] == literal) {
+                return AddOperand(false, literal_i);
+            }
+        }
+        literals.push_back(literal);
+        return AddOperand(false, literals.size() - 1);
+    }
+
+    std::int64_t operator() (const mapnik::value_null& val) {return AddLiteral(val);}
+    std::int64_t operator() (const mapnik::value_bool& val) {return AddLiteral(val);}
+    std::int64_t operator() (const mapnik::value_integer& val) {return AddLiteral(val);}
+    std::int64_t operator() (const mapnik::value_double& val) {return AddLiteral(val);}
+    std::int64_t operator() (const mapnik::value_unicode_string& val) {return AddLiteral(val);}
+
+    std::int64_t operator() (const mapnik::attribute& attr) {
+        auto attr_itr = std::find(attributes.begin(), attributes.end(), attr.name());
+        std::uint32_t slot = attr_itr - attributes.begin();
+        if (attr_itr == attributes.end()) {
+            attributes.push_back(attr.name());
+        }
+        return AddOperand(true, slot);
+    }
+
+    template <typename T>
+    std::int64_t operator() (const T&) {
+        return -1;
+    }
+};
+
+
+// Returns node index, -1 if expression can not be compiled
+struct filter_compiler {
+    using NodeType = CompiledFilter::NodeType;
+
+    CompiledFilter& filter;
+    std::map<std::tuple<NodeType, std::uint32_t, std::uint32_t>, std::uint32_t> node_ids;
+
+    std::int64_t AddNode(NodeType type, std::int64_t left, std::int64_t right) {
+        if (left < 0 || right < 0) {
+            return -1;
+        }
+        auto node_key = std::make_tuple(type, static_cast<std::uint32_t>(left), static_cast<std::uint32_t>(right));
+        auto node_itr = node_ids.find(node_key);
+        if (node_itr != node_ids.end()) {
+            return node_itr->second;
+        }
+        bool single_attribute = false;
+        if (type != NodeType::logical_and && type != NodeType::logical_or && type != NodeType::logical_not) {
+            const bool left_attribute = filter.operands_[left].attribute;
+            const bool right_attribute = filter.operands_[right].attribute;
+            single_attribute = type == NodeType::operand ? left_attribute : left_attribute != right_attribute;
+        }
+        filter.nodes_.push_back({type, single_attribute, static_cast<std::uint32_t>(left),
+                                 static_cast<std::uint32_t>(right)});
+        node_ids.emplace(node_key, filter.nodes_.size() - 1);
+        return filter.nodes_.size() - 1;
+    }
+
+    std::int64_t CompileOperand(const mapnik::expr_node& expr) {
+        operand_compiler compiler{filter.operands_, filter.literals_, filter.attributes_};
+        return mapnik::util::apply_visitor(compiler, expr);
+    }
+
+    std::int64_t Compare(NodeType type, const mapnik::expr_node& left, const mapnik::expr_node& right) {
+        return AddNode(type, CompileOperand(left), CompileOperand(right));
+    }
+
+    std::int64_t operator() (const mapnik::binary_node<mapnik::tags::equal_to>& node) {
+        return Compare(NodeType::equal, node.left, node.right);
+    }
+
+    std::int64_t operator() (const mapnik::binary_node<mapnik::tags::not_equal_to>& node) {
+        return Compare(NodeType::not_equal, node.left, node.right);
+    }
+
+    std::int64_t operator() (const mapnik::binary_node<mapnik::tags::less>& node) {
+        return Compare(NodeType::less, node.left, node.right);
+    }
+
+    std::int64_t operator() (const mapnik::binary_node<mapnik::tags::less_equal>& node) {
+        return Compare(NodeType::less_equal, node.left, node.right);
+    }
+
+    std::int64_t operator() (const mapnik::binary_node<mapnik::tags::greater>& node) {
+        return Compare(NodeType::greater, node.left, node.right);
+    }
+
+    std::int64_t operator() (const mapnik::binary_node<mapnik::tags::greater_equal>& node) {
+        return Compare(NodeType::greater_equal, node.left, node.right);
+    }
+
+    std::int64_t operator() (const mapnik::binary_node<mapnik::tags::logical_and>& node) {
+        std::int64_t left = mapnik::util::apply_visitor(*this, node.left);
+        return AddNode(NodeType::logical_and, left, mapnik::util::apply_visitor(*this, node.right));
+    }
+
+    std::int64_t operator() (const mapnik::binary_node<mapnik::tags::logical_or>& node) {
+        std::int64_t left = mapnik::util::apply_visitor(*this, node.left);
+        return AddNode(NodeType::logical_or, left, mapnik::util::apply_visitor(*this, node.right));
+    }
+
+    std::int64_t operator() (const mapnik::unary_node<mapnik::tags::logical_not>& node) {
+        std::int64_t expr = mapnik::util::apply_visitor(*this, node.expr);
+        return AddNode(NodeType::logical_not, expr, expr);
+    }
+
+    // Literal or attribute used as boolean
+    template <typename T>
+    std::int64_t operator() (const T& val) {
+        operand_compiler compiler{filter.operands_, filter.literals_, filter.attributes_};
+        std::int64_t operand = compiler(val);
+        return AddNode(NodeType::operand, operand, operand);
+    }
+};
+
+
+std::shared_ptr<const CompiledFilter> CompiledFilter::Compile(const mapnik::expr_node& expr) {
+    std::shared_ptr<CompiledFilter> filter(new CompiledFilter());
+    filter_compiler compiler{*filter, {}};
+    std::int64_t root = mapnik::util::apply_visitor(compiler, expr);
+    if (root < 0) {
+        return nullptr;
+    }
+    filter->root_ = static_cast<std::uint32_t>(root);
+    return filter;
+}
+
+
+CompiledFilter::LayerFilter::LayerFilter(std::shared_ptr<const CompiledFilter> filter,
+                                         const std::vector<std::string>& keys,
+                                         const std::vector<mapnik::value>& values) :
+        filter_(std::move(filter)),
+        values_(values),
+        key_slots_(keys.size(), -1),
+        slot_values_(filter_->attributes_.size(), -1),
+        value_matches_(filter_->nodes_.size()) {
+    const std::vector<std::string>& attributes = filter_->attributes_;
+    for (std::size_t key_i = 0; key_i < keys.size(); ++key_i) {
+        auto attr_itr = std::find(attributes.begin(), attributes.end(), keys[key_i]);
+        if (attr_itr != attributes.end()) {
+            key_slots_[key_i] = attr_itr - attributes.begin();
+        }
+    }
+}
+
+bool CompiledFilter::LayerFilter::Evaluate(const packed_uint_32_t& tags) {
+    std::fill(slot_values_.begin(), slot_values_.end(), -1);
+    for (auto tag_itr = tags.begin(); tag_itr != tags.end();) {
+        const std::size_t key_index = *(tag_itr++);
+        if (tag_itr == tags.end()) {
+            LOG(ERROR) << "Vector Tile has a feature with an odd number of tags, therefore the tile is invalid.";
+            return false;
+        }
+        const std::size_t value_index = *(tag_itr++);
+        if (key_index >= key_slots_.size() || value_index >= values_.size()) {
+            LOG(ERROR) << "Vector Tile has a feature with repeated attributes with an invalid key or value as it does not appear in the layer.";
+            continue;
+        }
+        const std::int32_t slot = key_slots_[key_index];
+        // The first value of repeated key is used
+        if (slot >= 0 && slot_values_[slot] < 0) {
+            slot_values_[slot] = value_index;
+        }
+    }
+    return EvaluateNode(filter_->root_);
+}
+
+inline const mapnik::value& CompiledFilter::LayerFilter::OperandValue(std::uint32_t operand_i) const noexcept {
+    const Operand& operand = filter_->operands_[operand_i];
+    if (!operand.attribute) {
+        return filter_->literals_[operand.index];
+    }
+    const std::int64_t value_index = slot_values_[operand.index];
+    return value_index >= 0 ? values_[value_index] : null_value;
+}
+
+bool CompiledFilter::LayerFilter::EvaluateNode(std::uint32_t node_i) {
+    const Node& node = filter_->nodes_[node_i];
+    switch (node.type) {
+    case NodeType::logical_and:
+        return EvaluateNode(node.left) && EvaluateNode(node.right);
+    case NodeType::logical_or:
+        return EvaluateNode(node.left) || EvaluateNode(node.right);
+    case NodeType::logical_not:
+        return !EvaluateNode(node.left);
+    default:
+        return node.single_attribute ? EvaluatePredicate(node_i, node) : Compare(node);
+    }
+}
+
+bool CompiledFilter::LayerFilter::EvaluatePredicate(std::uint32_t node_i, const Node& node) {
+    const Operand& left = filter_->operands_[node.left];
+    const std::uint32_t slot = left.attribute ? left.index : filter_->operands_[node.right].index;
+    const std::int64_t value_index = slot_values_[slot];
+    std::vector<std::int8_t>& matches = value_matches_[node_i];
+    if (matches.empty()) {
+        matches.assign(values_.size() + 1, -1);
+    }
+    std::int8_t& match = matches[value_index >= 0 ? value_index : values_.size()];
+    if (match < 0) {
+        match = Compare(node) ? 1 : 0;
+    }
+    return match > 0;
+}
+
+bool CompiledFilter::LayerFilter::Compare(const Node& node) const {
+    switch (node.type) {
+    case NodeType::operand:
+        return OperandValue(node.left).to_bool();
+    case NodeType::equal:
+        return OperandValue(node.left) == OperandValue(node.right);
+    case NodeType::not_equal:
+        return OperandValue(node.left) != OperandValue(node.right);
+    case NodeType::less:
+        return OperandValue(node.left) < OperandValue(node.right);
+    case NodeType::less_equal:
+        return OperandValue(node.left) <= OperandValue(node.right);
+    case NodeType::greater:
+        return OperandValue(node.left) > OperandValue(node.right);
+    case NodeType::greater_equal:
+        return OperandValue(node.left) >= OperandValue(node.right);
+    default:
+        return false;
+    }
+}
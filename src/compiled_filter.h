@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <mapnik/expression.hpp>
+#include <mapnik/value.hpp>
+
+#include <protozero/pbf_reader.hpp>
+
+
+// Filter expression compiled for evaluation on packed tags of vector tile features. Attributes are
+// resolved to layer key indices once per layer, so features are filtered without decoding their tags.
+// Only logical operators and comparisons of attributes and literals are compiled.
+class CompiledFilter {
+    struct Node;
+
+public:
+    using packed_uint_32_t = protozero::iterator_range<protozero::pbf_reader::const_uint32_iterator>;
+
+    // Returns nullptr if expression has nodes which can not be compiled
+    static std::shared_ptr<const CompiledFilter> Compile(const mapnik::expr_node& expr);
+
+    // Filter bound to key and value dictionaries of a layer. Dictionaries should outlive it.
+    class LayerFilter {
+    public:
+        LayerFilter(std::shared_ptr<const CompiledFilter> filter, const std::vector<std::string>& keys,
+                    const std::vector<mapnik::value>& values);
+
+        // Tags are packed pairs of key and value indices of feature
+        bool Evaluate(const packed_uint_32_t& tags);
+
+    private:
+        bool EvaluateNode(std::uint32_t node_i);
+        bool EvaluatePredicate(std::uint32_t node_i, const Node& node);
+        bool Compare(const Node& node) const;
+        const mapnik::value& OperandValue(std::uint32_t operand_i) const noexcept;
+
+        const std::shared_ptr<const CompiledFilter> filter_;
+        const std::vector<mapnik::value>& values_;
+        // Attribute slot by layer key index, -1 if key is not used by filter
+        std::vector<std::int32_t> key_slots_;
+        // Value index by attribute slot for current feature, -1 if feature has no such attribute
+        std::vector<std::int64_t> slot_values_;
+        // Results of predicates on one attribute by value index (the last one is for missing attribute):
+        // -1 if not evaluated yet. Tables are filled on first use, as dictionaries may have thousands
+        // of values and features of subtile use a few of them.
+        std::vector<std::vector<std::int8_t>> value_matches_;
+    };
+
+private:
+    enum class NodeType : std::uint8_t {
+        operand,
+        equal,
+        not_equal,
+        less,
+        less_equal,
+        greater,
+        greater_equal,
+        logical_and,
+        logical_or,
+        logical_not
+    };
+
+    // Left and right are operand indices for operand and comparison nodes, node indices otherwise.
+    // Operand is either literal or attribute slot.
+    struct Node {
+        NodeType type;
+        // Predicate on one attribute, its results are precomputed per layer value
+        bool single_attribute;
+        std::uint32_t left;
+        std::uint32_t right;
+    };
+
+    struct Operand {
+        bool attribute;
+        std::uint32_t index;
+    };
+
+    friend struct filter_compiler;
+    friend struct operand_compiler;
+
+    CompiledFilter() = default;
+
+    std::vector<Node> nodes_;
+    std::vector<Operand> operands_;
+    std::vector<mapnik::value> literals_;
+    std::vector<std::string> attributes_;
+    std::uint32_t root_{0};
+};
@@ -102,7 +102,8 @@ void DataManager::AddDataProvider(const std::string& provider_name, const Json::
         LOG(ERROR) << "Invalid max zoom: " << max_zoom;
         return;
     }
-    auto provider = std::make_shared<DataProvider>(std::move(loader), min_zoom, max_zoom, std::move(zoom_groups));
+    auto provider = std::make_shared<DataProvider>(provider_name, std::move(loader), min_zoom, max_zoom,
+                                                   std::move(zoom_groups));
     providers_map_.emplace(provider_name, std::move(provider));
 }
 
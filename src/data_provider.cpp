@@ -1,5 +1,7 @@
 #include "data_provider.h"
 
+#include <algorithm>
+
 #include <glog/logging.h>
 
 
@@ -7,8 +9,9 @@ using std::experimental::optional;
 using std::experimental::nullopt;
 using LoadError = TileLoader::LoadError;
 
-DataProvider::DataProvider(std::shared_ptr<TileLoader> loader, uint min_zoom, uint max_zoom,
+DataProvider::DataProvider(std::string name, std::shared_ptr<TileLoader> loader, uint min_zoom, uint max_zoom,
                            std::shared_ptr<zoom_groups_t> zoom_groups) :
+        name_(std::move(name)),
         loader_(std::move(loader)),
         zoom_groups_(std::move(zoom_groups)),
         min_zoom_(min_zoom),
@@ -73,23 +76,24 @@ inline optional<uint> DataProvider::GetBaseZoom(uint tile_zoom, uint zoom_offset
 }
 
 optional<MetatileId> DataProvider::GetOptimalMetatileId(const TileId& tile_id, uint zoom_offset) {
+    auto metatile_size = GetMaxMetatileSize(tile_id, zoom_offset);
+    if (!metatile_size) {
+        return nullopt;
+    }
+    // Limit metatile size to 8
+    return MetatileId(tile_id, std::min(*metatile_size, 8u));
+}
+
+optional<uint> DataProvider::GetMaxMetatileSize(const TileId& tile_id, uint zoom_offset) {
     assert(tile_id.Valid());
     if (tile_id.z == min_zoom_) {
-        return MetatileId(tile_id, 1);
+        return 1u;
     }
     auto base_zoom = GetBaseZoom(tile_id.z, zoom_offset);
     if (!base_zoom) {
         return nullopt;
     }
-
-    uint dz = tile_id.z - *base_zoom;
-
-    // Limit metatile size to 8
-    if (dz > 3) {
-        dz = 3;
-    }
-    uint metatile_size = std::pow(2u, dz);
-    return MetatileId(tile_id, metatile_size);
+    return 1u << (tile_id.z - *base_zoom);
 }
 
 optional<TileId> DataProvider::CalculateBaseTileId(const TileId& tile_id, uint zoom_offset) {
@@ -3,6 +3,7 @@
 #include <experimental/optional>
 #include <memory>
 #include <set>
+#include <string>
 
 #include "tile_loader.h"
 #include "tile.h"
@@ -13,7 +14,7 @@ public:
     using success_cb_t = TileLoader::LoadTask::result_cb_t;
     using error_cb_t = TileLoader::LoadTask::error_cb_t;
 
-    DataProvider(std::shared_ptr<TileLoader> loader, uint min_zoom, uint max_zoom,
+    DataProvider(std::string name, std::shared_ptr<TileLoader> loader, uint min_zoom, uint max_zoom,
                  std::shared_ptr<zoom_groups_t> zoom_groups = nullptr);
 
     std::shared_ptr<TileLoader::LoadTask> GetTile(success_cb_t success_cb, error_cb_t error_cb,
@@ -25,14 +26,22 @@ public:
 
     std::experimental::optional<MetatileId> GetOptimalMetatileId(const TileId& tile_id, uint zoom_offset = 0);
 
+    // Max size of metatile rendered from one data tile
+    std::experimental::optional<uint> GetMaxMetatileSize(const TileId& tile_id, uint zoom_offset = 0);
+
     inline bool HasVersion(const std::string& version) const {
         return loader_->HasVersion(version);
     }
 
+    inline const std::string& name() const noexcept {
+        return name_;
+    }
+
 private:
     std::experimental::optional<uint> GetBaseZoom(uint tile_zoom, uint zoom_offset);
     std::experimental::optional<TileId> CalculateBaseTileId(const TileId& tile_id, uint zoom_offset);
 
+    const std::string name_;
     std::shared_ptr<TileLoader> loader_;
     std::shared_ptr<zoom_groups_t> zoom_groups_;
     uint min_zoom_;
@@ -0,0 +1,85 @@
+#include "decoded_layer.h"
+
+#include <algorithm>
+
+#include <mapnik/query.hpp>
+
+#include <glog/logging.h>
+
+#include <vector_tile_datasource_pbf.hpp>
+
+#include "render_guard.h"
+
+
+static std::size_t CountFeatures(protozero::pbf_reader layer_pbf) {
+    std::size_t count = 0;
+    while (layer_pbf.next(mapnik::vector_tile_impl::Layer_Encoding::FEATURES)) {
+        layer_pbf.skip();
+        ++count;
+    }
+    return count;
+}
+
+std::shared_ptr<const DecodedLayer> DecodedLayer::Decode(protozero::pbf_reader layer_pbf, const TileId& tile_id) {
+    std::shared_ptr<DecodedLayer> layer(new DecodedLayer());
+    try {
+        mapnik::vector_tile_impl::tile_datasource_pbf ds(layer_pbf, tile_id.x, tile_id.y, tile_id.z, false);
+        layer->descriptor_ = ds.get_descriptor();
+        layer->geometry_type_ = ds.get_geometry_type();
+
+        // Features of buffer zone lie outside of tile extent, so tile extent is expanded by tile size
+        // on every side to get all of them.
+        mapnik::box2d<double> bbox = MetatileId(tile_id).GetBbox();
+        bbox.pad(std::max(bbox.width(), bbox.height()));
+        mapnik::query q(bbox);
+        for (const mapnik::attribute_descriptor& attr : layer->descriptor_.get_descriptors()) {
+            q.add_property_name(attr.get_name());
+        }
+
+        layer->features_.reserve(CountFeatures(layer_pbf));
+        layer->AddFeatures(ds.features(q));
+    } catch (const std::exception& e) {
+        LOG(ERROR) << "Unable to decode layer of data tile " << tile_id << ": " << e.what();
+        return nullptr;
+    }
+    return layer;
+}
+
+std::shared_ptr<const DecodedLayer> DecodedLayer::FromFeatureset(const mapnik::featureset_ptr& fs) {
+    std::shared_ptr<DecodedLayer> layer(new DecodedLayer());
+    layer->AddFeatures(fs);
+    return layer;
+}
+
+void DecodedLayer::AddFeatures(const mapnik::featureset_ptr& fs) {
+    if (!fs) {
+        return;
+    }
+    for (mapnik::feature_ptr feature = fs->next(); feature; feature = fs->next()) {
+        mapnik::box2d<double> envelope = feature->envelope();
+        features_.push_back(Entry{envelope, std::move(feature)});
+    }
+}
+
+mapnik::featureset_ptr DecodedLayer::features(const mapnik::box2d<double>& bbox) const {
+    return std::make_shared<DecodedFeatureset>(shared_from_this(), bbox);
+}
+
+
+DecodedFeatureset::DecodedFeatureset(std::shared_ptr<const DecodedLayer> layer, const mapnik::box2d<double>& bbox) :
+        layer_(std::move(layer)),
+        bbox_(bbox) {}
+
+mapnik::feature_ptr DecodedFeatureset::next() {
+    const auto& features = layer_->features_;
+    while (pos_ < features.size()) {
+        if ((pos_ & (kGuardCheckInterval - 1)) == 0) {
+            RenderGuard::CheckCurrent();
+        }
+        const DecodedLayer::Entry& entry = features[pos_++];
+        if (entry.envelope.intersects(bbox_)) {
+            return entry.feature;
+        }
+    }
+    return mapnik::feature_ptr();
+}
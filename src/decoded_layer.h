@@ -0,0 +1,83 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/optional.hpp>
+
+#include <mapnik/datasource.hpp>
+#include <mapnik/featureset.hpp>
+#include <mapnik/box2d.hpp>
+
+#include <protozero/pbf_reader.hpp>
+
+#include "lru_cache.h"
+#include "tile.h"
+
+
+// Layer of vector tile decoded once with all attributes over the whole tile extent (including buffer).
+// Decoded layer is never modified after decoding, so it is reused by renders of all metatiles
+// backed by the same data tile.
+class DecodedLayer : public std::enable_shared_from_this<DecodedLayer> {
+public:
+    // Returns nullptr if layer can not be decoded
+    static std::shared_ptr<const DecodedLayer> Decode(protozero::pbf_reader layer_pbf, const TileId& tile_id);
+
+    // Collects all features of featureset, fs may be nullptr
+    static std::shared_ptr<const DecodedLayer> FromFeatureset(const mapnik::featureset_ptr& fs);
+
+    // Featureset over features intersecting bbox. Featureset keeps decoded layer alive.
+    mapnik::featureset_ptr features(const mapnik::box2d<double>& bbox) const;
+
+    inline const mapnik::layer_descriptor& descriptor() const noexcept {
+        return descriptor_;
+    }
+
+    inline const boost::optional<mapnik::datasource_geometry_t>& geometry_type() const noexcept {
+        return geometry_type_;
+    }
+
+    inline std::size_t size() const noexcept {
+        return features_.size();
+    }
+
+private:
+    friend class DecodedFeatureset;
+
+    struct Entry {
+        // Envelope is calculated once to not walk geometry on every query
+        mapnik::box2d<double> envelope;
+        mapnik::feature_ptr feature;
+    };
+
+    DecodedLayer() = default;
+
+    void AddFeatures(const mapnik::featureset_ptr& fs);
+
+    // Envelopes are stored next to features, so bbox scans of queries touch one contiguous block
+    std::vector<Entry> features_;
+    mapnik::layer_descriptor descriptor_{"", ""};
+    boost::optional<mapnik::datasource_geometry_t> geometry_type_;
+};
+
+
+class DecodedFeatureset : public mapnik::Featureset {
+public:
+    DecodedFeatureset(std::shared_ptr<const DecodedLayer> layer, const mapnik::box2d<double>& bbox);
+
+    // Aborts render of current thread if needed, see RenderGuard
+    mapnik::feature_ptr next() override;
+
+private:
+    // Power of two
+    static constexpr std::size_t kGuardCheckInterval = 256;
+
+    const std::shared_ptr<const DecodedLayer> layer_;
+    const mapnik::box2d<double> bbox_;
+    std::size_t pos_{0};
+};
+
+
+// Decoded layers shared by all render workers
+using DecodedLayerCache = SharedLRUCache<DecodedLayer>;
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <functional>
+
+#include "thread_pool.h"
+#include "worker.h"
+
+
+// Encoding of one tile of rendered metatile.
+struct EncodeTask {
+    std::function<void()> fn;
+};
+
+
+// Worker of the pool encoding rendered tiles, so render workers are not blocked by encoding.
+class EncodeWorker : public Worker<EncodeTask> {
+public:
+    void ProcessTask(EncodeTask task) noexcept override {
+        task.fn();
+    }
+};
+
+using encode_pool_t = ThreadPool<EncodeWorker, EncodeTask>;
@@ -7,6 +7,8 @@
 
 class FilterTable;
 class DataProvider;
+class MetatileSizer;
+class TileEncoder;
 
 enum class EndpointType : uint8_t {
     static_files,
@@ -17,6 +19,12 @@ enum class EndpointType : uint8_t {
 struct EndpointParams {
     std::shared_ptr<FilterTable> filter_table;
     std::shared_ptr<DataProvider> data_provider;
+    // Chooses metatile size by render cost if set, metatile width and height are ignored then
+    std::shared_ptr<MetatileSizer> metatile_sizer;
+    // Output profile of png tiles, nullptr for default one
+    std::shared_ptr<const TileEncoder> tile_encoder;
+    // Encoder of webp tiles, nullptr if webp output is not allowed
+    std::shared_ptr<const TileEncoder> webp_encoder;
     std::string style_name;
     std::string utfgrid_key;
     uint minzoom;
@@ -27,5 +35,7 @@ struct EndpointParams {
     EndpointType type;
     bool allow_layers_query{false};
     bool allow_utf_grid{false};
+    // Render utfgrid together with every image (and vice versa), both are cached
+    bool utfgrid_with_image{false};
     bool auto_metatile_size{false};
 };
@@ -0,0 +1,81 @@
+#include "feature_index.h"
+
+#include <glog/logging.h>
+#include <protozero/pbf_reader.hpp>
+
+#include <mapnik/box2d_impl.hpp>
+
+#include <vector_tile_config.hpp>
+
+
+using packed_uint_32_t = protozero::iterator_range<protozero::pbf_reader::const_uint32_iterator>;
+
+// Expands bbox by all points of encoded geometry. Returns false on invalid geometry.
+static bool ExpandGeometryBbox(const packed_uint_32_t& packed_geometry,
+                               mapnik::box2d<std::int64_t>* bbox, bool* has_points) {
+    std::int64_t x = 0, y = 0;
+    auto itr = packed_geometry.begin();
+    const auto end = packed_geometry.end();
+    while (itr != end) {
+        const std::uint32_t command = *(itr++);
+        const std::uint32_t command_id = command & 0x7;
+        if (command_id == 7) { // close_path
+            continue;
+        }
+        if (command_id != 1 && command_id != 2) { // move_to, line_to
+            return false;
+        }
+        for (std::uint32_t count = command >> 3; count > 0; --count) {
+            if (itr == end) {
+                return false;
+            }
+            x += protozero::decode_zigzag32(*(itr++));
+            if (itr == end) {
+                return false;
+            }
+            y += protozero::decode_zigzag32(*(itr++));
+            if (*has_points) {
+                bbox->expand_to_include(x, y);
+            } else {
+                bbox->init(x, y, x, y);
+                *has_points = true;
+            }
+        }
+    }
+    return true;
+}
+
+static mapnik::box2d<std::int64_t> GetFeatureBbox(protozero::pbf_reader feature_pbf) {
+    mapnik::box2d<std::int64_t> bbox;
+    bool has_points = false;
+    while (feature_pbf.next(mapnik::vector_tile_impl::Feature_Encoding::GEOMETRY)) {
+        if (!ExpandGeometryBbox(feature_pbf.get_packed_uint32(), &bbox, &has_points)) {
+            LOG(ERROR) << "Vector Tile contains invalid geometry";
+            return mapnik::box2d<std::int64_t>();
+        }
+    }
+    return has_points ? bbox : mapnik::box2d<std::int64_t>();
+}
+
+std::shared_ptr<const TileFeatureIndex> TileFeatureIndex::Build(const std::string& tile_data) {
+    std::shared_ptr<TileFeatureIndex> index(new TileFeatureIndex());
+    protozero::pbf_reader tile_message(tile_data);
+    while (tile_message.next(mapnik::vector_tile_impl::Tile_Encoding::LAYERS)) {
+        index->layers_.emplace_back();
+        Layer& layer = index->layers_.back();
+        protozero::pbf_reader layer_message = tile_message.get_message();
+        while (layer_message.next(mapnik::vector_tile_impl::Layer_Encoding::FEATURES)) {
+            layer.features.push_back(GetFeatureBbox(layer_message.get_message()));
+            const mapnik::box2d<std::int64_t>& feature_bbox = layer.features.back();
+            if (!feature_bbox.valid()) {
+                continue;
+            }
+            if (layer.bbox.valid()) {
+                layer.bbox.expand_to_include(feature_bbox);
+            } else {
+                layer.bbox = feature_bbox;
+            }
+        }
+    }
+    return index;
+}
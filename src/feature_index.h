@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <mapnik/box2d.hpp>
+
+#include "lru_cache.h"
+
+
+// Bounding boxes of features of vector tile in layer coordinates. Index is built once per data tile,
+// so subtiles skip features outside of them without decoding geometries and tags.
+class TileFeatureIndex {
+public:
+    struct Layer {
+        // Bbox of all features, invalid if layer has no valid features
+        mapnik::box2d<std::int64_t> bbox;
+        // Bboxes in order of features in layer message, invalid for features with invalid geometry
+        std::vector<mapnik::box2d<std::int64_t>> features;
+    };
+
+    static std::shared_ptr<const TileFeatureIndex> Build(const std::string& tile_data);
+
+    // Layer in order of layers in tile message, nullptr if out of range
+    inline const Layer* layer(std::size_t layer_i) const noexcept {
+        return layer_i < layers_.size() ? &layers_[layer_i] : nullptr;
+    }
+
+private:
+    TileFeatureIndex() = default;
+
+    std::vector<Layer> layers_;
+};
+
+
+// Feature indexes of data tiles shared by render workers
+using FeatureIndexCache = SharedLRUCache<TileFeatureIndex>;
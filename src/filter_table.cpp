@@ -127,9 +127,11 @@ void FilterTable::ParseMap(const mapnik::Map &map, const zoom_groups_t* zoom_gro
             const std::string& layer_name = layer_itr->first;
             const LayerFilters& layer_filters = layer_itr->second;
             if (layer_filters.no_filters) {
-                filters_map[layer_name] = nullptr;
+                filters_map[layer_name] = LayerFilter();
             } else if (!layer_filters.filters.empty()){
-                filters_map[layer_name] = MergeFilters(layer_filters.filters);
+                LayerFilter& layer_filter = filters_map[layer_name];
+                layer_filter.expression = MergeFilters(layer_filters.filters);
+                layer_filter.compiled = CompiledFilter::Compile(*layer_filter.expression);
             }
         }
     }
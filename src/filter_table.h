@@ -3,11 +3,21 @@
 #include <mapnik/map.hpp>
 #include <mapnik/expression.hpp>
 
+#include "compiled_filter.h"
+
 
 class FilterTable {
 public:    
     using zoom_groups_t = std::set<uint>;
-    using filter_map_t = std::unordered_map<std::string, mapnik::expression_ptr>;
+
+    struct LayerFilter {
+        // nullptr if all features of layer pass
+        mapnik::expression_ptr expression;
+        // nullptr if expression can not be compiled
+        std::shared_ptr<const CompiledFilter> compiled;
+    };
+
+    using filter_map_t = std::unordered_map<std::string, LayerFilter>;
 
     static std::unique_ptr<FilterTable> MakeFilterTable(const std::string& map_path,
                                                         const zoom_groups_t* zoom_groups = nullptr,
@@ -6,10 +6,13 @@
 #include "config.h"
 #include "couchbase_cacher.h"
 #include "json_util.h"
+#include "metatile_sizer.h"
 #include "mon_handler.h"
 #include "nodes_monitor.h"
+#include "profile_handler.h"
 #include "status_monitor.h"
 #include "tile_cacher.h"
+#include "tile_encoder.h"
 #include "tile_handler.h"
 #include "tile_processing_manager.h"
 #include "util.h"
@@ -97,11 +100,34 @@ static std::shared_ptr<endpoints_map_t> ParseEndpoints(const Json::Value jendpoi
                     LOG(ERROR) << "No utfgrid key for endpoint '" << endpoint_path << "' provided!";
                     params->allow_utf_grid = false;
                 }
+                params->utfgrid_with_image = params->allow_utf_grid &&
+                        FromJson<bool>(jparams["utfgrid_with_image"], false);
                 if (params->style_name.empty()) {
                     LOG(ERROR) << "No style name for endpoint '" << endpoint_path << "' provided!";
                     LOG(ERROR) << "Skipping endpoint \"" << endpoint_path << '"';
                     continue;
                 }
+                const Json::Value& joutput = jparams["output"];
+                if (!joutput.isNull()) {
+                    params->tile_encoder = TileEncoder::MakeEncoder(joutput);
+                    if (!params->tile_encoder) {
+                        LOG(ERROR) << "Invalid output profile for endpoint '" << endpoint_path << "' provided!";
+                        LOG(ERROR) << "Skipping endpoint \"" << endpoint_path << '"';
+                        continue;
+                    }
+                }
+                // "webp": true enables webp output with default profile, object sets webp profile
+                const Json::Value& jwebp = jparams["webp"];
+                if (jwebp.isObject() || (jwebp.isBool() && jwebp.asBool())) {
+                    Json::Value jwebp_output = jwebp.isObject() ? jwebp : Json::Value(Json::objectValue);
+                    jwebp_output["format"] = "webp";
+                    params->webp_encoder = TileEncoder::MakeEncoder(jwebp_output);
+                    if (!params->webp_encoder) {
+                        LOG(ERROR) << "Invalid webp profile for endpoint '" << endpoint_path << "' provided!";
+                        LOG(ERROR) << "Skipping endpoint \"" << endpoint_path << '"';
+                        continue;
+                    }
+                }
             } else if (type == "mvt") {
                 params->type = EndpointType::mvt;
                 if (!params->data_provider) {
@@ -121,13 +147,16 @@ static std::shared_ptr<endpoints_map_t> ParseEndpoints(const Json::Value jendpoi
                 continue;
             }
             const Json::Value& jmetatile_size = jparams["metatile_size"];
-            if (jmetatile_size.isString()) {
-                if (jmetatile_size.asString() == "auto") {
-                    if (!params->data_provider) {
-                        LOG(ERROR) << "Auto metatile size can be used only with data provider!";
-                    } else {
-                        params->auto_metatile_size = true;
-                    }
+            if (jmetatile_size.isString() && jmetatile_size.asString() == "auto") {
+                if (!params->data_provider) {
+                    LOG(ERROR) << "Auto metatile size can be used only with data provider!";
+                } else {
+                    params->auto_metatile_size = true;
+                }
+            } else if (jmetatile_size.isString() || jmetatile_size.isObject()) {
+                params->metatile_sizer = MetatileSizer::MakeSizer(jmetatile_size);
+                if (!params->metatile_sizer) {
+                    LOG(ERROR) << "Invalid metatile size for endpoint '" << endpoint_path << "'!";
                 }
             } else if (jmetatile_size.isUInt()) {
                 uint metatile_size = jmetatile_size.asUInt();
@@ -219,6 +248,9 @@ proxygen::RequestHandler* HttpHandlerFactory::onRequest(proxygen::RequestHandler
     if (method == HTTPMethod::GET && path == "/mon") {
         return new MonHandler(monitor_);
     }
+    if (method == HTTPMethod::GET && path == "/profile" && msg->getDstPort() == internal_port_) {
+        return new ProfileHandler(render_manager_.profiler());
+    }
     auto endpoints = std::atomic_load(&endpoints_);
     return new TileHandler(internal_port_, *timer_->timer, *processing_manager_,
                            endpoints, cacher_, nodes_monitor_);
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <list>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <unordered_map>
 
 #include <experimental/optional>
@@ -10,13 +13,18 @@ class LRUCache {
 public:
     LRUCache(std::size_t capacity) : capacity_(capacity) {}
 
-    bool Set(const std::string& key, T value) {
+    // If evicted is provided, value evicted from cache is moved to it, so caller decides
+    // when to destroy it (e.g. outside of the lock).
+    bool Set(const std::string& key, T value, T* evicted = nullptr) {
         auto item_map_itr = items_map_.find(key);
         if (item_map_itr == items_map_.end()) {
             items_.emplace_back(key, std::move(value));
             items_map_[key] = --items_.end();
             if (items_.size() > capacity_) {
                 item_t& first_item = items_.front();
+                if (evicted) {
+                    *evicted = std::move(first_item.second);
+                }
                 items_map_.erase(first_item.first);
                 items_.pop_front();
             }
@@ -25,7 +33,7 @@ public:
 
         auto item_itr = item_map_itr->second;
         item_itr->second = std::move(value);
-        items_.splice(item_itr, items_, items_.end());
+        items_.splice(items_.end(), items_, item_itr);
         return false;
     }
 
@@ -35,7 +43,7 @@ public:
             return std::experimental::nullopt;
         }
         auto item_itr = item_map_itr->second;
-        items_.splice(item_itr, items_, items_.end());
+        items_.splice(items_.end(), items_, item_itr);
         return item_itr->second;
     }
 
@@ -62,3 +70,32 @@ private:
     std::unordered_map<std::string, typename items_list_t::iterator> items_map_;
     std::size_t capacity_;
 };
+
+
+// LRU cache of immutable values shared by workers. Values are used without locking after lookup.
+template <typename T>
+class SharedLRUCache {
+public:
+    using value_ptr_t = std::shared_ptr<const T>;
+
+    SharedLRUCache(std::size_t capacity) : cache_(capacity) {}
+
+    inline value_ptr_t Get(const std::string& key) {
+        std::lock_guard<std::mutex> lock(mux_);
+        auto value = cache_.Get(key);
+        return value ? *value : nullptr;
+    }
+
+    inline void Set(const std::string& key, value_ptr_t value) {
+        value_ptr_t evicted;
+        {
+            std::lock_guard<std::mutex> lock(mux_);
+            cache_.Set(key, std::move(value), &evicted);
+        }
+        // Evicted value may be large, so it is freed without blocking other workers
+    }
+
+private:
+    LRUCache<value_ptr_t> cache_;
+    std::mutex mux_;
+};
@@ -0,0 +1,153 @@
+#include "metatile_sizer.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <glog/logging.h>
+
+#include "json_util.h"
+
+using json_util::FromJson;
+
+
+// Cost must double before grown metatile is shrunk back and vice versa
+static constexpr double kGrowThreshold = 0.5;
+static constexpr double kShrinkThreshold = 1.0;
+static constexpr double kCostSmoothing = 0.3;
+// Popularity is number of requests for approximately this period
+static constexpr double kPopularityWindowSec = 60.0;
+// Stats are reset when too many regions are tracked, zoom costs are kept
+static constexpr std::size_t kMaxRegions = 1u << 16;
+
+static inline bool IsPowerOfTwo(uint value) noexcept {
+    return value > 0 && (value & (value - 1)) == 0;
+}
+
+// Largest power of two not greater than value
+static inline uint FloorPowerOfTwo(uint value) noexcept {
+    uint result = 1;
+    while (result * 2 <= value) {
+        result *= 2;
+    }
+    return result;
+}
+
+std::shared_ptr<MetatileSizer> MetatileSizer::MakeSizer(const Json::Value& jparams) {
+    MetatileSizerParams params;
+    if (jparams.isString()) {
+        if (jparams.asString() != "adaptive") {
+            return nullptr;
+        }
+    } else if (jparams.isObject()) {
+        params.min_size = FromJson<uint>(jparams["min"], params.min_size);
+        params.max_size = FromJson<uint>(jparams["max"], params.max_size);
+        params.initial_size = FromJson<uint>(jparams["initial"],
+                                             std::min(std::max(params.initial_size, params.min_size),
+                                                      params.max_size));
+        params.target_time = std::chrono::milliseconds(FromJson<uint>(
+                jparams["target_ms"], std::chrono::duration_cast<std::chrono::milliseconds>(
+                    params.target_time).count()));
+        params.region_size = FromJson<uint>(jparams["region_size"], params.region_size);
+        params.popular_requests = FromJson<double>(jparams["popular_requests"], params.popular_requests);
+    } else {
+        return nullptr;
+    }
+    if (!IsPowerOfTwo(params.min_size) || !IsPowerOfTwo(params.max_size) || !IsPowerOfTwo(params.initial_size) ||
+            params.min_size > params.max_size || params.initial_size < params.min_size ||
+            params.initial_size > params.max_size || params.target_time.count() == 0 ||
+            // Aligned metatiles should not straddle regions, as their cost is charged to one region
+            !IsPowerOfTwo(params.region_size) || params.region_size < params.max_size) {
+        LOG(ERROR) << "Invalid adaptive metatile size params!";
+        return nullptr;
+    }
+    return std::shared_ptr<MetatileSizer>(new MetatileSizer(params));
+}
+
+MetatileSizer::MetatileSizer(const MetatileSizerParams& params) : params_(params) {
+    zoom_tile_cost_.fill(-1.0);
+}
+
+uint MetatileSizer::GetSize(const TileId& tile_id, uint size_limit) {
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(mux_);
+    RegionStats& region = GetRegion(tile_id);
+    std::chrono::duration<double> since_last = now - region.last_request;
+    region.popularity = region.popularity * std::exp(-since_last.count() / kPopularityWindowSec) + 1.0;
+    region.last_request = now;
+
+    if (region.size == 0) {
+        double tile_cost = tile_id.z < zoom_tile_cost_.size() ? zoom_tile_cost_[tile_id.z] : -1.0;
+        if (tile_cost < 0.0) {
+            region.size = params_.initial_size;
+        } else {
+            // Largest size fitting target time by render cost of the zoom
+            region.size = params_.min_size;
+            while (region.size < params_.max_size &&
+                   tile_cost * 4 * region.size * region.size <= params_.target_time.count()) {
+                region.size *= 2;
+            }
+        }
+    }
+    uint size = std::min(region.size, MaxSize(region, now));
+    return std::min(size, FloorPowerOfTwo(std::max(size_limit, 1u)));
+}
+
+void MetatileSizer::RecordRender(const MetatileId& metatile_id, std::chrono::microseconds render_time) {
+    const uint num_tiles = metatile_id.width() * metatile_id.height();
+    if (num_tiles == 0) {
+        return;
+    }
+    const double tile_cost = static_cast<double>(render_time.count()) / num_tiles;
+    const TileId& tile_id = metatile_id.left_top();
+    const auto now = std::chrono::steady_clock::now();
+
+    std::lock_guard<std::mutex> lock(mux_);
+    if (tile_id.z < zoom_tile_cost_.size()) {
+        double& zoom_cost = zoom_tile_cost_[tile_id.z];
+        zoom_cost = zoom_cost < 0.0 ? tile_cost : zoom_cost * (1.0 - kCostSmoothing) + tile_cost * kCostSmoothing;
+    }
+    RegionStats& region = GetRegion(tile_id);
+    if (region.tile_cost < 0.0) {
+        region.tile_cost = tile_cost;
+    } else {
+        region.tile_cost = region.tile_cost * (1.0 - kCostSmoothing) + tile_cost * kCostSmoothing;
+    }
+    if (region.size == 0) {
+        region.size = params_.initial_size;
+    }
+
+    const double target = params_.target_time.count();
+    const double size_cost = region.tile_cost * region.size * region.size;
+    if (region.size > params_.min_size && size_cost > target * kShrinkThreshold) {
+        region.size /= 2;
+    } else if (region.size < MaxSize(region, now) && 4 * size_cost < target * kGrowThreshold) {
+        region.size *= 2;
+    }
+}
+
+inline std::uint64_t MetatileSizer::RegionKey(const TileId& tile_id) const noexcept {
+    std::uint64_t rx = tile_id.x / params_.region_size;
+    std::uint64_t ry = tile_id.y / params_.region_size;
+    return (static_cast<std::uint64_t>(tile_id.z) << 58) | (rx << 29) | ry;
+}
+
+MetatileSizer::RegionStats& MetatileSizer::GetRegion(const TileId& tile_id) {
+    if (regions_.size() >= kMaxRegions) {
+        regions_.clear();
+    }
+    return regions_[RegionKey(tile_id)];
+}
+
+inline bool MetatileSizer::IsPopular(const RegionStats& region,
+                                     std::chrono::steady_clock::time_point now) const noexcept {
+    std::chrono::duration<double> since_last = now - region.last_request;
+    return region.popularity * std::exp(-since_last.count() / kPopularityWindowSec) >= params_.popular_requests;
+}
+
+inline uint MetatileSizer::MaxSize(const RegionStats& region,
+                                   std::chrono::steady_clock::time_point now) const noexcept {
+    if (IsPopular(region, now)) {
+        return params_.max_size;
+    }
+    return std::min(params_.max_size, params_.min_size * 2);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include <jsoncpp/json/value.h>
+
+#include "tile.h"
+
+
+struct MetatileSizerParams {
+    // Power of two bounds of metatile size
+    uint min_size{1};
+    uint max_size{8};
+    // Size used until render cost of region and zoom is measured
+    uint initial_size{4};
+    // Desired render time of one metatile
+    std::chrono::microseconds target_time{std::chrono::milliseconds(500)};
+    // Region side in tiles (power of two, not less than max_size), render cost and popularity are tracked per region
+    uint region_size{64};
+    // Regions with fewer requests per minute get small metatiles only
+    double popular_requests{16.0};
+};
+
+
+// Chooses metatile size per zoom and region from measured render cost and tile popularity.
+// Metatiles of expensive regions shrink, so requested tile is not delayed by rendering of its neighbours.
+// Metatiles of cheap regions grow, so per-render overhead is amortized. Neighbours of rarely requested
+// tiles are unlikely to be requested, so such regions get small metatiles.
+// Sizes are powers of two and change by one step with hysteresis, so metatiles stay aligned and stable.
+class MetatileSizer {
+public:
+    // Makes sizer from endpoint "metatile_size" config: "adaptive" or object with params.
+    // Returns nullptr on invalid config.
+    static std::shared_ptr<MetatileSizer> MakeSizer(const Json::Value& jparams);
+
+    // Returns size of metatile for requested tile, size_limit is max size allowed by caller
+    // (e.g. metatile should not span several data tiles). Counts request for region popularity.
+    uint GetSize(const TileId& tile_id, uint size_limit);
+
+    // Feeds render time of metatile back to the sizer
+    void RecordRender(const MetatileId& metatile_id, std::chrono::microseconds render_time);
+
+    inline uint max_size() const noexcept {
+        return params_.max_size;
+    }
+
+private:
+    struct RegionStats {
+        // Render time per tile in microseconds, negative while unknown
+        double tile_cost{-1.0};
+        // Exponentially decayed request count
+        double popularity{0.0};
+        std::chrono::steady_clock::time_point last_request;
+        uint size{0};
+    };
+
+    MetatileSizer(const MetatileSizerParams& params);
+
+    std::uint64_t RegionKey(const TileId& tile_id) const noexcept;
+    RegionStats& GetRegion(const TileId& tile_id);
+    bool IsPopular(const RegionStats& region, std::chrono::steady_clock::time_point now) const noexcept;
+    uint MaxSize(const RegionStats& region, std::chrono::steady_clock::time_point now) const noexcept;
+
+    const MetatileSizerParams params_;
+    std::unordered_map<std::uint64_t, RegionStats> regions_;
+    // Render time per tile of whole zoom, used for regions not rendered yet
+    std::array<double, 32> zoom_tile_cost_;
+    std::mutex mux_;
+};
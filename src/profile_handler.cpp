@@ -0,0 +1,24 @@
+#include "profile_handler.h"
+
+#include <jsoncpp/json/value.h>
+#include <proxygen/httpserver/ResponseBuilder.h>
+
+
+ProfileHandler::ProfileHandler(std::shared_ptr<RenderProfiler> profiler) : profiler_(std::move(profiler)) { }
+
+void ProfileHandler::onRequest(std::unique_ptr<proxygen::HTTPMessage> headers) noexcept {
+    if (profiler_ == nullptr) {
+        SendError(404);
+        return;
+    }
+    std::string profile = profiler_->ToJson(headers->hasQueryParam("reset")).toStyledString();
+    proxygen::ResponseBuilder rb(downstream_);
+    rb.status(200, "OK");
+    rb.header(proxygen::HTTP_HEADER_CONTENT_TYPE, "application/json");
+    rb.body(folly::IOBuf::copyBuffer(profile));
+    rb.sendWithEOM();
+}
+
+void ProfileHandler::onBody(std::unique_ptr<folly::IOBuf> body) noexcept { }
+
+void ProfileHandler::onSuccessEOM() noexcept { }
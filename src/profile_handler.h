@@ -0,0 +1,17 @@
+#pragma once
+
+#include "base_handler.h"
+#include "render_profiler.h"
+
+// Serves aggregated render profile as JSON. Profile is reset after response if "reset" query param is set.
+class ProfileHandler : public BaseHandler {
+public:
+    explicit ProfileHandler(std::shared_ptr<RenderProfiler> profiler);
+
+    void onRequest(std::unique_ptr<proxygen::HTTPMessage> headers) noexcept override;
+    void onBody(std::unique_ptr<folly::IOBuf> body) noexcept override;
+    void onSuccessEOM() noexcept override;
+
+private:
+   std::shared_ptr<RenderProfiler> profiler_;
+};
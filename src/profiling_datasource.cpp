@@ -0,0 +1,59 @@
+#include "profiling_datasource.h"
+
+#include <cassert>
+
+using std::chrono::steady_clock;
+
+
+ProfilingDataSource::ProfilingDataSource(mapnik::datasource_ptr ds, LayerProfile& profile)
+    : datasource(mapnik::parameters()),
+      p_datasource_(std::move(ds)),
+      profile_(profile)
+{
+    assert(p_datasource_);
+}
+
+mapnik::datasource::datasource_t ProfilingDataSource::type() const {
+    return p_datasource_->type();
+}
+
+boost::optional<mapnik::datasource_geometry_t> ProfilingDataSource::get_geometry_type() const {
+    return p_datasource_->get_geometry_type();
+}
+
+mapnik::featureset_ptr ProfilingDataSource::features(mapnik::query const& q) const {
+    const auto start_time = steady_clock::now();
+    mapnik::featureset_ptr fs = p_datasource_->features(q);
+    profile_.query_time += steady_clock::now() - start_time;
+    if (!fs) {
+        return fs;
+    }
+    return std::make_shared<ProfilingFeatureset>(std::move(fs), profile_);
+}
+
+mapnik::featureset_ptr ProfilingDataSource::features_at_point(mapnik::coord2d const& pt, double tol) const {
+    return p_datasource_->features_at_point(pt, tol);
+}
+
+mapnik::box2d<double> ProfilingDataSource::envelope() const {
+    return p_datasource_->envelope();
+}
+
+mapnik::layer_descriptor ProfilingDataSource::get_descriptor() const {
+    return p_datasource_->get_descriptor();
+}
+
+
+ProfilingFeatureset::ProfilingFeatureset(mapnik::featureset_ptr fs, LayerProfile& profile) :
+        fs_(std::move(fs)),
+        profile_(profile) {}
+
+mapnik::feature_ptr ProfilingFeatureset::next() {
+    const auto start_time = steady_clock::now();
+    mapnik::feature_ptr feature = fs_->next();
+    profile_.query_time += steady_clock::now() - start_time;
+    if (feature) {
+        ++profile_.num_features;
+    }
+    return feature;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <mapnik/datasource.hpp>
+#include <mapnik/featureset.hpp>
+
+#include "render_profiler.h"
+
+// Proxy datasource measuring time of queries and featureset iteration of profiled render.
+// Profile must outlive datasource and its featuresets.
+class ProfilingDataSource : public mapnik::datasource {
+public:
+    ProfilingDataSource(mapnik::datasource_ptr ds, LayerProfile& profile);
+
+    datasource_t type() const override;
+    boost::optional<mapnik::datasource_geometry_t> get_geometry_type() const override;
+    mapnik::featureset_ptr features(mapnik::query const& q) const override;
+    mapnik::featureset_ptr features_at_point(mapnik::coord2d const& pt, double tol = 0) const override;
+    mapnik::box2d<double> envelope() const override;
+    mapnik::layer_descriptor get_descriptor() const override;
+
+private:
+    const mapnik::datasource_ptr p_datasource_;
+    LayerProfile& profile_;
+};
+
+
+class ProfilingFeatureset : public mapnik::Featureset {
+public:
+    ProfilingFeatureset(mapnik::featureset_ptr fs, LayerProfile& profile);
+
+    mapnik::feature_ptr next() override;
+
+private:
+    const mapnik::featureset_ptr fs_;
+    LayerProfile& profile_;
+};
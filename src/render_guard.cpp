@@ -0,0 +1,35 @@
+#include "render_guard.h"
+
+
+static thread_local RenderGuard* current_guard = nullptr;
+
+RenderGuard::RenderGuard(const AsyncTaskBase& task, clock_t::time_point deadline) :
+        task_(task),
+        deadline_(deadline),
+        prev_(current_guard) {
+    current_guard = this;
+}
+
+RenderGuard::~RenderGuard() {
+    current_guard = prev_;
+}
+
+void RenderGuard::Check() const {
+    if (task_.cancelled()) {
+        throw RenderAborted("render cancelled", false);
+    }
+    if (clock_t::now() > deadline_) {
+        std::string what = "render time budget exceeded";
+        if (layer_name_) {
+            what.append(" on layer ");
+            what.append(*layer_name_);
+        }
+        throw RenderAborted(what, true);
+    }
+}
+
+void RenderGuard::CheckCurrent() {
+    if (current_guard) {
+        current_guard->Check();
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <chrono>
+#include <stdexcept>
+#include <string>
+
+#include "async_task.h"
+
+
+// Thrown to abort render of cancelled task or render exceeding its time budget
+class RenderAborted : public std::runtime_error {
+public:
+    RenderAborted(const std::string& what, bool timed_out) : std::runtime_error(what), timed_out_(timed_out) {}
+
+    inline bool timed_out() const noexcept {
+        return timed_out_;
+    }
+
+private:
+    bool timed_out_;
+};
+
+
+// Aborts render which has no consumers anymore or exceeded its deadline. Render worker checks guard
+// between layers, featuresets of data tile layers check guard of current thread while features are
+// iterated, i.e. while styles of layer are processed.
+class RenderGuard {
+public:
+    using clock_t = std::chrono::steady_clock;
+
+    // Makes guard current for the thread for its lifetime
+    RenderGuard(const AsyncTaskBase& task, clock_t::time_point deadline);
+    ~RenderGuard();
+
+    RenderGuard(const RenderGuard&) = delete;
+    RenderGuard& operator=(const RenderGuard&) = delete;
+
+    // Throws RenderAborted if render should be aborted
+    void Check() const;
+
+    // Checks guard of current thread if any
+    static void CheckCurrent();
+
+    // Layer processed now, reported when render is aborted
+    inline void set_layer(const std::string& layer_name) noexcept {
+        layer_name_ = &layer_name;
+    }
+
+private:
+    const AsyncTaskBase& task_;
+    const clock_t::time_point deadline_;
+    const std::string* layer_name_{nullptr};
+    RenderGuard* prev_;
+};
@@ -0,0 +1,95 @@
+#include "render_profiler.h"
+
+#include <algorithm>
+#include <random>
+
+#include <glog/logging.h>
+
+#include "json_util.h"
+
+using json_util::FromJson;
+
+
+std::shared_ptr<RenderProfiler> RenderProfiler::MakeProfiler(const Json::Value& jparams) {
+    if (!jparams.isObject()) {
+        return nullptr;
+    }
+    double sample_rate = FromJson<double>(jparams["sample_rate"], 0.0);
+    if (sample_rate <= 0.0) {
+        return nullptr;
+    }
+    if (sample_rate > 1.0) {
+        LOG(WARNING) << "Profiling sample rate " << sample_rate << " is greater than 1, all renders are profiled";
+        sample_rate = 1.0;
+    }
+    return std::shared_ptr<RenderProfiler>(new RenderProfiler(sample_rate));
+}
+
+RenderProfiler::RenderProfiler(double sample_rate) : sample_rate_(sample_rate) {}
+
+bool RenderProfiler::ShouldSample() const noexcept {
+    if (sample_rate_ >= 1.0) {
+        return true;
+    }
+    static thread_local std::minstd_rand generator{std::random_device()()};
+    std::uniform_real_distribution<double> distribution(0.0, 1.0);
+    return distribution(generator) < sample_rate_;
+}
+
+void RenderProfiler::AddRender(const std::string& style_name, uint zoom, std::chrono::microseconds render_time,
+                               const std::vector<LayerProfile>& layers) {
+    std::lock_guard<std::mutex> lock(mux_);
+    ZoomStats& zoom_stats = styles_[style_name][zoom];
+    ++zoom_stats.renders;
+    zoom_stats.render_us += render_time.count();
+    for (const LayerProfile& layer : layers) {
+        if (!layer.rendered) {
+            continue;
+        }
+        LayerStats& layer_stats = zoom_stats.layers[layer.name];
+        ++layer_stats.samples;
+        layer_stats.total_us += std::chrono::duration_cast<std::chrono::microseconds>(layer.total_time).count();
+        layer_stats.query_us += std::chrono::duration_cast<std::chrono::microseconds>(layer.query_time).count();
+        layer_stats.num_features += layer.num_features;
+    }
+}
+
+Json::Value RenderProfiler::ToJson(bool reset) {
+    styles_stats_t styles;
+    {
+        std::lock_guard<std::mutex> lock(mux_);
+        if (reset) {
+            styles.swap(styles_);
+        } else {
+            styles = styles_;
+        }
+    }
+
+    Json::Value jprofile(Json::objectValue);
+    jprofile["sample_rate"] = sample_rate_;
+    Json::Value& jstyles = jprofile["styles"] = Json::Value(Json::objectValue);
+    for (const auto& style_itr : styles) {
+        Json::Value& jstyle = jstyles[style_itr.first] = Json::Value(Json::objectValue);
+        for (const auto& zoom_itr : style_itr.second) {
+            const ZoomStats& zoom_stats = zoom_itr.second;
+            Json::Value& jzoom = jstyle[std::to_string(zoom_itr.first)];
+            jzoom["renders"] = Json::UInt64(zoom_stats.renders);
+            jzoom["avg_render_ms"] = zoom_stats.render_us / 1000.0 / zoom_stats.renders;
+            Json::Value& jlayers = jzoom["layers"] = Json::Value(Json::objectValue);
+            for (const auto& layer_itr : zoom_stats.layers) {
+                const LayerStats& layer_stats = layer_itr.second;
+                const double samples = layer_stats.samples;
+                Json::Value& jlayer = jlayers[layer_itr.first];
+                jlayer["samples"] = Json::UInt64(layer_stats.samples);
+                jlayer["avg_ms"] = layer_stats.total_us / 1000.0 / samples;
+                jlayer["avg_query_ms"] = layer_stats.query_us / 1000.0 / samples;
+                // Time not spent in datasource is time of symbolizers
+                jlayer["avg_symbolizers_ms"] = (layer_stats.total_us - std::min(layer_stats.total_us,
+                                                                               layer_stats.query_us)) /
+                        1000.0 / samples;
+                jlayer["avg_features"] = layer_stats.num_features / samples;
+            }
+        }
+    }
+    return jprofile;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <jsoncpp/json/value.h>
+
+
+// Cost of one layer in one render
+struct LayerProfile {
+    std::string name;
+    // Time of layer processing including datasource queries. Clock precision is kept,
+    // as iteration of one feature takes less than microsecond.
+    std::chrono::steady_clock::duration total_time{0};
+    // Time spent in datasource queries and featureset iteration
+    std::chrono::steady_clock::duration query_time{0};
+    std::uint64_t num_features{0};
+    bool rendered{false};
+};
+
+
+// Aggregates layer costs of sampled renders per style and zoom.
+class RenderProfiler {
+public:
+    // Makes profiler from "render/profiling" config. Returns nullptr if profiling is disabled.
+    static std::shared_ptr<RenderProfiler> MakeProfiler(const Json::Value& jparams);
+
+    // Decides whether current render should be profiled
+    bool ShouldSample() const noexcept;
+
+    void AddRender(const std::string& style_name, uint zoom, std::chrono::microseconds render_time,
+                   const std::vector<LayerProfile>& layers);
+
+    // Averages per style, zoom and layer. If reset is set, stats are cleared in the same lock,
+    // so no samples are lost between snapshot and reset.
+    Json::Value ToJson(bool reset = false);
+
+private:
+    struct LayerStats {
+        std::uint64_t samples{0};
+        std::uint64_t total_us{0};
+        std::uint64_t query_us{0};
+        std::uint64_t num_features{0};
+    };
+
+    struct ZoomStats {
+        std::uint64_t renders{0};
+        std::uint64_t render_us{0};
+        std::map<std::string, LayerStats> layers;
+    };
+
+    using styles_stats_t = std::map<std::string, std::map<uint, ZoomStats>>;
+
+    RenderProfiler(double sample_rate);
+
+    const double sample_rate_;
+    styles_stats_t styles_;
+    mutable std::mutex mux_;
+};
@@ -0,0 +1,86 @@
+#include "render_style.h"
+
+#include <mapnik/feature_type_style.hpp>
+#include <mapnik/layer.hpp>
+#include <mapnik/load_map.hpp>
+#include <mapnik/rule.hpp>
+
+#include <glog/logging.h>
+
+#include <mapbox2mapnik/mapbox2mapnik.hpp>
+
+#include "load_map.h"
+
+static const std::string kMapProj = "+proj=merc +a=6378137 +b=6378137 +lat_ts=0.0 +lon_0=0.0 +x_0=0.0 +y_0=0.0 +k=1.0 "
+                                    "+units=m +nadgrids=@null +wktext +no_defs +over";
+
+// Buffer size of layers rendered from mvt tiles
+static const int kMvtLayerBufferSize = 256;
+
+
+RenderStyle::RenderStyle(const StyleInfo& style_info) :
+        map_(256, 256, kMapProj),
+        name_(style_info.name),
+        version_(style_info.version),
+        allow_grid_render_(style_info.allow_grid_render) {}
+
+std::shared_ptr<const RenderStyle> RenderStyle::LoadStyle(const StyleInfo& style_info) {
+    if (style_info.name.empty()) {
+        LOG(ERROR) << "Empty style name";
+        return nullptr;
+    }
+    std::shared_ptr<RenderStyle> style(new RenderStyle(style_info));
+    mapnik::Map& map = style->map_;
+    try {
+        if (!style_info.path.empty()) {
+            sputnik::load_map(map, style_info.path);
+        } else if (style_info.data && !style_info.data->empty()){
+            if (style_info.type == StyleInfo::Type::mapnik) {
+                mapnik::load_map_string(map, *style_info.data, false, style_info.base_path);
+            } else {
+                sputnik::load_mapbox_map_string(map, *style_info.data, false, style_info.base_path);
+            }
+        } else {
+            LOG(ERROR) << "No style path, nor style data provided!";
+            return nullptr;
+        }
+    } catch (const std::exception& e) {
+        LOG(ERROR) << "Error while loading style " << style_info.name << ": " << e.what();
+        return nullptr;
+    }
+
+    CalculateLayersSD(map);
+    // Mvt layers (layers without ds) get datasource from data tile on every render, set 900913 proj for them
+    for (mapnik::layer& layer : map.layers()) {
+        if (layer.datasource() == nullptr) {
+            layer.set_srs(map.srs());
+            layer.set_buffer_size(kMvtLayerBufferSize);
+        }
+    }
+    return style;
+}
+
+void RenderStyle::CalculateLayersSD(mapnik::Map& map) {
+    const auto& styles = map.styles();
+    for (auto &layer : map.layers()) {
+        double min_sd = 1000000000;
+        double max_sd = 0;
+        for (const auto &style_name : layer.styles()) {
+            const auto style_itr = styles.find(style_name);
+            if (style_itr == styles.end()) {
+                continue;
+            }
+            const auto& style = style_itr->second;
+            for (const auto &rule : style.get_rules()) {
+                min_sd = std::min(min_sd, rule.get_min_scale());
+                max_sd = std::max(max_sd, rule.get_max_scale());
+            }
+        }
+        if (min_sd != 1000000000) {
+            layer.set_minimum_scale_denominator(min_sd);
+        }
+        if (max_sd != 0) {
+            layer.set_maximum_scale_denominator(max_sd);
+        }
+    }
+}
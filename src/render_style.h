@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include <mapnik/map.hpp>
+
+
+struct StyleInfo {
+    enum class Type : std::uint8_t {
+        mapnik,
+        mvt
+    };
+
+    std::string name;
+    std::string path;
+    std::string base_path;
+    std::shared_ptr<std::string> data;
+    uint version{0};
+    Type type{Type::mapnik};
+    bool allow_grid_render{false};
+};
+
+
+// Parsed style (map with styles, fonts, symbols and expressions). Style is loaded once and shared
+// by all render workers, so it is never modified after loading. Workers render it with their own
+// copies of layers, see RenderWorker.
+class RenderStyle {
+public:
+    static std::shared_ptr<const RenderStyle> LoadStyle(const StyleInfo& style_info);
+
+    static void CalculateLayersSD(mapnik::Map& map);
+
+    RenderStyle(const RenderStyle&) = delete;
+    RenderStyle& operator=(const RenderStyle&) = delete;
+
+    inline const mapnik::Map& map() const noexcept {
+        return map_;
+    }
+
+    inline const std::string& name() const noexcept {
+        return name_;
+    }
+
+    inline uint version() const noexcept {
+        return version_;
+    }
+
+    inline bool allow_grid_render() const noexcept {
+        return allow_grid_render_;
+    }
+
+private:
+    RenderStyle(const StyleInfo& style_info);
+
+    mapnik::Map map_;
+    const std::string name_;
+    const uint version_;
+    const bool allow_grid_render_;
+};
+
+
+// Styles published to render workers. Update replaces the whole set of styles at once (RCU-like),
+// renders in progress keep using the styles they started with.
+class StyleRegistry {
+public:
+    using styles_t = std::unordered_map<std::string, std::shared_ptr<const RenderStyle>>;
+
+    inline std::shared_ptr<const styles_t> styles() const noexcept {
+        return std::atomic_load(&styles_);
+    }
+
+    inline void set_styles(std::shared_ptr<const styles_t> styles) noexcept {
+        std::atomic_store(&styles_, std::move(styles));
+    }
+
+    inline std::shared_ptr<const RenderStyle> GetStyle(const std::string& name) const {
+        auto styles_ptr = styles();
+        if (!styles_ptr) {
+            return nullptr;
+        }
+        auto style_itr = styles_ptr->find(name);
+        return style_itr != styles_ptr->end() ? style_itr->second : nullptr;
+    }
+
+private:
+    std::shared_ptr<const styles_t> styles_;
+};
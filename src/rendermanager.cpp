@@ -1,11 +1,22 @@
 #include "rendermanager.h"
 
+#include <sys/resource.h>
+
 #include <fstream>
 
 #include <glog/logging.h>
+#include <zlib.h>
 
+#include "json_util.h"
 #include "subtiler.h"
 
+using json_util::FromJson;
+
+
+// Render pool sub-queue shared by all MVT subtiling requests. Starts with NUL, so it can not be
+// taken by a style name.
+static const std::string kSubtileQueueKey("\0mvt", 4);
+
 
 static bool ParseStyleInfo(const std::string& name, const Json::Value& jstyle_info, StyleInfo& style_info) {
     style_info.name = name;
@@ -41,6 +52,27 @@ static bool ParseStyleInfo(const std::string& name, const Json::Value& jstyle_in
 }
 
 
+static render_queue_weights_t ParseQueueWeights(const Json::Value& jweights) {
+    render_queue_weights_t weights;
+    if (jweights.isNull()) {
+        return weights;
+    }
+    if (!jweights.isObject()) {
+        LOG(ERROR) << "render/queue_weights should be an object!";
+        return weights;
+    }
+    for (Json::ValueConstIterator jweight_itr = jweights.begin(); jweight_itr != jweights.end(); ++jweight_itr) {
+        const Json::Value& jweight = *jweight_itr;
+        if (!jweight.isUInt() || jweight.asUInt() == 0) {
+            LOG(ERROR) << "Queue weight for \"" << jweight_itr.name() << "\" should be positive integer!";
+            continue;
+        }
+        weights[jweight_itr.name()] = jweight.asUInt();
+    }
+    return weights;
+}
+
+
 static bool ParseStyles(const Json::Value& jstyles, std::vector<StyleInfo>& styles) {
     if (!jstyles.isObject()) {
         return false;
@@ -63,8 +95,19 @@ void StyleUpdateObserver::OnUpdate(std::shared_ptr<Json::Value> value) {
 }
 
 
+static std::chrono::microseconds ProcessCpuTime() noexcept {
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return std::chrono::microseconds(0);
+    }
+    return std::chrono::seconds(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+            std::chrono::microseconds(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+}
+
+
 RenderManager::RenderManager(Config& config) :
-        active_styles_(std::make_shared<std::vector<style_version_t>>()),
+        styles_(std::make_shared<StyleRegistry>()),
+        pool_stats_(std::make_shared<RenderPoolStats>()),
         update_observer_(*this),
         config_(config)
 {
@@ -74,68 +117,196 @@ RenderManager::RenderManager(Config& config) :
     uint queue_limit = jqueue_limit.isIntegral() ? jqueue_limit.asUInt() : 1000u;
     render_pool_.SetQueueLimit(queue_limit);
 
-    std::shared_ptr<std::vector<StyleInfo>> styles;
+    std::shared_ptr<const Json::Value> jqueue_weights_ptr = config.GetValue("render/queue_weights");
+    if (jqueue_weights_ptr) {
+        render_queue_weights_t weights = ParseQueueWeights(*jqueue_weights_ptr);
+        render_pool_.ModifyQueue([&weights](render_queue_t& queue) {
+            queue.SetWeights(std::move(weights));
+        });
+    }
+
+    auto styles = std::make_shared<StyleRegistry::styles_t>();
     std::shared_ptr<const Json::Value> jstyles = config.GetValue("render/styles");
 //    std::shared_ptr<const Json::Value> jstyles = config.GetValue("render/styles", &update_observer_);
     if (jstyles->isObject()) {
-        styles = std::make_shared<std::vector<StyleInfo>>();
-        auto num_styles = jstyles->size();
-        styles->reserve(num_styles);
-        active_styles_->reserve(num_styles);
+        styles->reserve(jstyles->size());
         for (Json::ValueConstIterator jstyle_itr = jstyles->begin(); jstyle_itr != jstyles->end(); ++jstyle_itr) {
             const std::string& style_name = jstyle_itr.name();
-            styles->emplace_back();
-            if (!ParseStyleInfo(style_name, *jstyle_itr, styles->back())) {
-                styles->pop_back();
+            StyleInfo style_info;
+            if (!ParseStyleInfo(style_name, *jstyle_itr, style_info)) {
                 continue;
             }
-            for (const auto& style : *active_styles_) {
-                if (style.first == style_name) {
-                    LOG(ERROR) << "Duplicate style name: " << style_name;
-                    styles->pop_back();
-                    continue;
-                }
+            // Style is parsed once here and shared by all workers
+            auto style = RenderStyle::LoadStyle(style_info);
+            if (!style) {
+                LOG(ERROR) << "Unable to load style " << style_name << ". Skipping it.";
+                continue;
             }
-            const StyleInfo& style_info = styles->back();
-            active_styles_->emplace_back(std::move(style_name), style_info.version);
+            (*styles)[style_name] = std::move(style);
         }
     } else {
         LOG(WARNING) << "No styles provided";
     }
+    styles_->set_styles(std::move(styles));
 
     std::shared_ptr<const Json::Value> jworkers_ptr = config.GetValue("render/workers");
     assert(jworkers_ptr);
     const Json::Value& jworkers = *jworkers_ptr;
     uint num_workers = jworkers.isIntegral() ? jworkers.asUInt() : std::thread::hardware_concurrency();
+
+    std::shared_ptr<const Json::Value> jautoscale_ptr = config.GetValue("render/autoscale");
+    if (jautoscale_ptr && jautoscale_ptr->isObject()) {
+        const Json::Value& jautoscale = *jautoscale_ptr;
+        AutoscaleParams& params = autoscale_params_;
+        params.min_workers = std::max(1u, FromJson<uint>(jautoscale["min_workers"], 1));
+        params.max_workers = FromJson<uint>(jautoscale["max_workers"], 2 * std::thread::hardware_concurrency());
+        params.interval = std::chrono::milliseconds(FromJson<uint>(jautoscale["interval_ms"], 5000));
+        params.grow_wait = std::chrono::milliseconds(FromJson<uint>(jautoscale["grow_wait_ms"], 200));
+        params.shrink_wait = std::chrono::milliseconds(FromJson<uint>(jautoscale["shrink_wait_ms"], 20));
+        params.cpu_threshold = FromJson<double>(jautoscale["cpu_threshold"], 0.9);
+        params.io_threshold = FromJson<double>(jautoscale["io_threshold"], 0.3);
+        params.shrink_utilization = FromJson<double>(jautoscale["shrink_utilization"], 0.5);
+        if (params.max_workers < params.min_workers || params.interval.count() == 0) {
+            LOG(ERROR) << "Invalid render/autoscale params! Autoscaling disabled.";
+        } else {
+            params.enabled = true;
+            num_workers = std::min(std::max(num_workers, params.min_workers), params.max_workers);
+        }
+    }
+
+    std::shared_ptr<const Json::Value> jprofiling_ptr = config.GetValue("render/profiling");
+    if (jprofiling_ptr) {
+        profiler_ = RenderProfiler::MakeProfiler(*jprofiling_ptr);
+    }
+
+    std::shared_ptr<const Json::Value> jtime_budget_ptr = config.GetValue("render/time_budget_ms");
+    if (jtime_budget_ptr) {
+        render_time_budget_ = std::chrono::milliseconds(FromJson<uint>(*jtime_budget_ptr, 0));
+    }
+
+    std::shared_ptr<const Json::Value> jutfgrid_resolution_ptr = config.GetValue("render/utfgrid_resolution");
+    if (jutfgrid_resolution_ptr) {
+        const uint utfgrid_resolution = FromJson<uint>(*jutfgrid_resolution_ptr, utfgrid_resolution_);
+        // Grid of every tile should have integer size
+        if (utfgrid_resolution > 0 && 256 % utfgrid_resolution == 0) {
+            utfgrid_resolution_ = utfgrid_resolution;
+        } else {
+            LOG(WARNING) << "UTFGrid resolution " << utfgrid_resolution << " is not a divisor of 256, " <<
+                            utfgrid_resolution_ << " is used";
+        }
+    }
+
+    std::shared_ptr<const Json::Value> jmvt_compression_ptr = config.GetValue("render/mvt_compression");
+    if (jmvt_compression_ptr) {
+        const int mvt_compression_level = FromJson<int>(*jmvt_compression_ptr, mvt_compression_level_);
+        if (mvt_compression_level <= 9) {
+            mvt_compression_level_ = mvt_compression_level;
+        } else {
+            LOG(WARNING) << "MVT compression level should not be greater than 9, " <<
+                            mvt_compression_level_ << " is used";
+        }
+    }
+
+    std::shared_ptr<const Json::Value> jmvt_strategy_ptr = config.GetValue("render/mvt_compression_strategy");
+    if (jmvt_strategy_ptr) {
+        const std::string strategy = FromJson<std::string>(*jmvt_strategy_ptr, "default");
+        if (strategy == "filtered") {
+            mvt_compression_strategy_ = Z_FILTERED;
+        } else if (strategy == "huffman") {
+            mvt_compression_strategy_ = Z_HUFFMAN_ONLY;
+        } else if (strategy == "rle") {
+            mvt_compression_strategy_ = Z_RLE;
+        } else if (strategy != "default") {
+            LOG(WARNING) << "Unsupported MVT compression strategy: " << strategy << ", default is used";
+        }
+    }
+
+    std::shared_ptr<const Json::Value> jdecoded_layers_ptr = config.GetValue("render/decoded_layers_cache_size");
+    uint decoded_layers_cache_size = 1024;
+    if (jdecoded_layers_ptr) {
+        decoded_layers_cache_size = FromJson<uint>(*jdecoded_layers_ptr, decoded_layers_cache_size);
+    }
+    if (decoded_layers_cache_size > 0) {
+        decoded_layers_ = std::make_shared<DecodedLayerCache>(decoded_layers_cache_size);
+    }
+
+    std::shared_ptr<const Json::Value> jfeature_indexes_ptr = config.GetValue("render/feature_index_cache_size");
+    uint feature_index_cache_size = 256;
+    if (jfeature_indexes_ptr) {
+        feature_index_cache_size = FromJson<uint>(*jfeature_indexes_ptr, feature_index_cache_size);
+    }
+    if (feature_index_cache_size > 0) {
+        feature_indexes_ = std::make_shared<FeatureIndexCache>(feature_index_cache_size);
+    }
+
+    std::shared_ptr<const Json::Value> jencode_workers_ptr = config.GetValue("render/encode_workers");
+    uint num_encode_workers = std::thread::hardware_concurrency();
+    if (jencode_workers_ptr) {
+        num_encode_workers = FromJson<uint>(*jencode_workers_ptr, num_encode_workers);
+    }
+    for (uint i = 0; i < num_encode_workers; ++i) {
+        encode_pool_.PushWorker(std::make_unique<EncodeWorker>(), nullptr);
+    }
+
     rsem_ = std::make_unique<RSemaphore>(num_workers);
     for (uint i = 0; i < num_workers; ++i) {
-        auto render_worker = std::make_unique<RenderWorker>(styles);
+        auto render_worker = std::make_unique<RenderWorker>(styles_, pool_stats_, GetEncodePool(),
+                                                            decoded_layers_, profiler_,
+                                                            feature_indexes_);
         auto init_task = std::make_shared<render_pool_t::WorkerInitTask>(
                     [&](render_pool_t::worker_t*) { rsem_->signal(); }, false);
         render_pool_.PushWorker(std::move(render_worker), std::move(init_task));
     }
 
-    // Check if we already have style updates
-    inited_ = true;
-//    TryProcessStyleUpdate();
+    style_update_thread_ = std::thread(&RenderManager::StyleUpdateLoop, this);
+    if (autoscale_params_.enabled) {
+        autoscale_thread_ = std::thread(&RenderManager::AutoscaleLoop, this);
+    }
 }
 
 RenderManager::~RenderManager() {
+    if (autoscale_thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(autoscale_mux_);
+            stop_autoscale_ = true;
+        }
+        autoscale_cv_.notify_all();
+        autoscale_thread_.join();
+    }
+    {
+        std::lock_guard<std::mutex> lock(style_update_mux_);
+        stop_style_update_ = true;
+    }
+    style_update_cv_.notify_all();
+    style_update_thread_.join();
     render_pool_.Stop();
+    encode_pool_.Stop();
 }
 
 
 std::shared_ptr<RenderTask> RenderManager::Render(std::unique_ptr<RenderRequest> request,
                                                   std::function<void (render_result_t&&)> success_callback,
-                                                  std::function<void ()> error_callback) {
+                                                  std::function<void ()> error_callback,
+                                                  std::weak_ptr<const AsyncTaskBase> consumer) {
     assert(request);
     auto task = std::make_shared<RenderTask>(std::move(success_callback), std::move(error_callback), false);
+    if (!consumer.expired()) {
+        task->SetConsumer(std::move(consumer));
+    }
+    if (request->time_budget.count() == 0) {
+        request->time_budget = render_time_budget_;
+    }
+    if (request->utfgrid_resolution == 0) {
+        request->utfgrid_resolution = utfgrid_resolution_;
+    }
     if (!has_style(request->style_name)) {
         LOG(ERROR) << "Style \"" << request->style_name << "\" not found!";
         task->NotifyError();
         return task;
     }
-    render_pool_.PostTask(TileWorkTask{task, std::move(request)});
+    std::string queue_key = request->style_name;
+    render_pool_.PostTask(TileWorkTask{task, std::move(request), std::move(queue_key),
+                                       std::chrono::steady_clock::now()});
     return task;
 }
 
@@ -149,94 +320,170 @@ std::shared_ptr<RenderTask> RenderManager::MakeSubtile(std::unique_ptr<SubtileRe
         task->NotifyError();
         return task;
     }
-    render_pool_.PostTask(TileWorkTask{task, std::move(request)});
+    request->compression_level = mvt_compression_level_;
+    request->compression_strategy = mvt_compression_strategy_;
+    render_pool_.PostTask(TileWorkTask{task, std::move(request), kSubtileQueueKey,
+                                       std::chrono::steady_clock::now()});
     return task;
 }
 
 uint RenderManager::GetStyleVersion(const std::string& style_name) {
-    auto active_styles = std::atomic_load(&active_styles_);
-    for (const auto& style_info : *active_styles) {
-        if (style_info.first == style_name) {
-            return style_info.second;
-        }
-    }
-    return 0;
+    auto style = styles_->GetStyle(style_name);
+    return style ? style->version() : 0;
 }
 
 void RenderManager::PostStyleUpdate(std::shared_ptr<const Json::Value> jstyles) {
     assert(jstyles);
-    std::atomic_store(&styles_update_, std::move(jstyles));
-    TryProcessStyleUpdate();
+    {
+        std::lock_guard<std::mutex> lock(style_update_mux_);
+        styles_update_ = std::move(jstyles);
+    }
+    style_update_cv_.notify_one();
 }
 
-void RenderManager::TryProcessStyleUpdate() {
-    if (!inited_ || !std::atomic_load(&styles_update_)) {
-        return;
+void RenderManager::StyleUpdateLoop() {
+    std::unique_lock<std::mutex> lock(style_update_mux_);
+    while (true) {
+        style_update_cv_.wait(lock, [this] { return stop_style_update_ || styles_update_; });
+        if (stop_style_update_) {
+            return;
+        }
+        // Only the latest update is processed if several updates were posted during loading
+        std::shared_ptr<const Json::Value> jstyles = std::move(styles_update_);
+        styles_update_.reset();
+        lock.unlock();
+        ProcessStyleUpdate(*jstyles);
+        lock.lock();
     }
-    bool expected = false;
-    if (!updating_.compare_exchange_strong(expected, true)) {
+}
+
+void RenderManager::ProcessStyleUpdate(const Json::Value& jstyles) {
+    std::vector<StyleInfo> styles_info;
+    if (!ParseStyles(jstyles, styles_info)) {
+        LOG(ERROR) << "Invalid styles update!";
         return;
     }
-    std::shared_ptr<const Json::Value> jstyles = std::atomic_exchange(&styles_update_,
-                                                                      std::shared_ptr<const Json::Value>());
-    if (!jstyles || !ParseStyles(*jstyles, pending_update_)) {
-        FinishUpdate();
-        return;
+    auto current_styles = styles_->styles();
+    auto new_styles = std::make_shared<StyleRegistry::styles_t>();
+    new_styles->reserve(styles_info.size());
+    for (const StyleInfo& style_info : styles_info) {
+        std::shared_ptr<const RenderStyle> style;
+        if (current_styles) {
+            auto style_itr = current_styles->find(style_info.name);
+            if (style_itr != current_styles->end() && style_itr->second->version() == style_info.version) {
+                style = style_itr->second;
+            }
+        }
+        if (!style) {
+            style = RenderStyle::LoadStyle(style_info);
+            if (!style) {
+                LOG(ERROR) << "Unable to load style " << style_info.name << ". Cancelling update!";
+                return;
+            }
+        }
+        (*new_styles)[style_info.name] = std::move(style);
     }
+    // Workers pick up new styles on their next render
+    styles_->set_styles(std::move(new_styles));
+    LOG(INFO) << "Styles updated";
+}
+
+void RenderManager::WaitForInit() {
+    rsem_->wait();
+}
 
-    workers_to_update_ = render_pool_.Workers();
-    if (workers_to_update_.empty()) {
-        LOG(WARNING) << "Render pool has no workers! Skipping update!";
+void RenderManager::AddWorkers(uint num_workers) {
+    for (uint i = 0; i < num_workers; ++i) {
+        // Worker prepares its layers of shared styles in its own thread and starts processing tasks after that
+        auto render_worker = std::make_unique<RenderWorker>(styles_, pool_stats_, GetEncodePool(),
+                                                            decoded_layers_, profiler_,
+                                                            feature_indexes_);
+        auto init_task = std::make_shared<render_pool_t::WorkerInitTask>(
+                    [](render_pool_t::worker_t*) { LOG(INFO) << "Render worker started"; },
+                    [this](render_pool_t::worker_t* worker) {
+            LOG(ERROR) << "Error while initializing render worker!";
+            std::lock_guard<std::mutex> lock(failed_workers_mux_);
+            failed_workers_.push_back(worker);
+        }, false);
+        render_pool_.PushWorker(std::move(render_worker), std::move(init_task));
     }
-    render_pool_.ExecuteOnWorker(std::bind(&RenderManager::UpdateWorker, this, std::placeholders::_1),
-                                 workers_to_update_.back());
 }
 
-void RenderManager::UpdateWorker(RenderWorker& worker) {
-    if (!worker.UpdateStyles(pending_update_)) {
-        LOG(ERROR) << "Error updating worker " << workers_to_update_.size() << ". Cancelling update!";
-        const auto* pending_update_ptr = &pending_update_;
-        for (const RenderWorker* rw : updated_workers_) {
-            render_pool_.ExecuteOnWorker([pending_update_ptr](RenderWorker& wrk) {
-                wrk.CancelUpdate(pending_update_ptr);
-            }, rw);
-        }
-        FinishUpdate();
-    } else {
-        updated_workers_.push_back(workers_to_update_.back());
-        workers_to_update_.pop_back();
-        if (workers_to_update_.empty()) {
-            // All workers updated
-            const auto* pending_update_ptr = &pending_update_;
-            for (const RenderWorker* rw : updated_workers_) {
-                render_pool_.ExecuteOnWorker([pending_update_ptr](RenderWorker& wrk) {
-                    wrk.CommitUpdate(pending_update_ptr);
-                }, rw);
-            }
-            // Update style names set
-            auto new_active_styles = std::make_shared<std::vector<style_version_t>>();
-            new_active_styles->reserve(pending_update_.size());
-            for (const StyleInfo& style_info : pending_update_) {
-                new_active_styles->emplace_back(style_info.name, style_info.version);
-            }
-            std::atomic_store(&active_styles_, std::move(new_active_styles));
-            FinishUpdate();
-        } else {
-            // Update next worker
-            render_pool_.ExecuteOnWorker(std::bind(&RenderManager::UpdateWorker, this, std::placeholders::_1),
-                                         workers_to_update_.back());
-        }
+void RenderManager::RemoveFailedWorkers() {
+    std::vector<RenderWorker*> failed_workers;
+    {
+        std::lock_guard<std::mutex> lock(failed_workers_mux_);
+        failed_workers.swap(failed_workers_);
+    }
+    for (RenderWorker* worker : failed_workers) {
+        render_pool_.RemoveWorker(worker);
     }
 }
 
-void RenderManager::FinishUpdate() {
-    workers_to_update_.clear();
-    updated_workers_.clear();
-    pending_update_.clear();
-    updating_ = false;
-    TryProcessStyleUpdate();
+RenderManager::PoolSample RenderManager::TakeSample() const {
+    PoolSample sample;
+    sample.time = std::chrono::steady_clock::now();
+    sample.process_cpu_time = ProcessCpuTime();
+    sample.num_tasks = pool_stats_->num_tasks;
+    sample.queue_wait_us = pool_stats_->queue_wait_us;
+    sample.busy_us = pool_stats_->busy_us;
+    sample.cpu_us = pool_stats_->cpu_us;
+    return sample;
 }
 
-void RenderManager::WaitForInit() {
-    rsem_->wait();
+void RenderManager::AutoscaleLoop() {
+    PoolSample prev_sample = TakeSample();
+    std::unique_lock<std::mutex> lock(autoscale_mux_);
+    while (!autoscale_cv_.wait_for(lock, autoscale_params_.interval, [this] { return stop_autoscale_; })) {
+        lock.unlock();
+        PoolSample sample = TakeSample();
+        RemoveFailedWorkers();
+        Autoscale(prev_sample, sample);
+        prev_sample = sample;
+        lock.lock();
+    }
+}
+
+void RenderManager::Autoscale(const PoolSample& prev_sample, const PoolSample& sample) {
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+    const AutoscaleParams& params = autoscale_params_;
+    const double interval_us = duration_cast<microseconds>(sample.time - prev_sample.time).count();
+    const uint num_workers = render_pool_.NumWorkers();
+    if (interval_us <= 0 || num_workers == 0) {
+        return;
+    }
+    const std::uint64_t num_tasks = sample.num_tasks - prev_sample.num_tasks;
+    const std::uint64_t busy_us = sample.busy_us - prev_sample.busy_us;
+    const std::uint64_t cpu_us = sample.cpu_us - prev_sample.cpu_us;
+    const std::size_t queue_size = render_pool_.QueueSize();
+
+    const double avg_wait_us = num_tasks > 0 ?
+                static_cast<double>(sample.queue_wait_us - prev_sample.queue_wait_us) / num_tasks : 0.0;
+    const double io_ratio = busy_us > 0 ? 1.0 - std::min(1.0, static_cast<double>(cpu_us) / busy_us) : 0.0;
+    const uint num_cpus = std::max(1u, std::thread::hardware_concurrency());
+    const double cpu_load = (sample.process_cpu_time - prev_sample.process_cpu_time).count() /
+            (interval_us * num_cpus);
+    const double utilization = busy_us / (interval_us * num_workers);
+
+    const double grow_wait_us = duration_cast<microseconds>(params.grow_wait).count();
+    const double shrink_wait_us = duration_cast<microseconds>(params.shrink_wait).count();
+    // If no task was taken from the queue during interval, all workers are stuck on long renders
+    const bool queue_stalled = num_tasks == 0 && queue_size > 0;
+
+    if ((avg_wait_us > grow_wait_us || queue_stalled) && num_workers < params.max_workers) {
+        if (cpu_load >= params.cpu_threshold && io_ratio < params.io_threshold) {
+            // CPU is saturated by CPU bound rendering, new workers will not help
+            return;
+        }
+        uint num_new_workers = std::min(std::max(1u, num_workers / 8), params.max_workers - num_workers);
+        LOG(INFO) << "Adding " << num_new_workers << " render workers to " << num_workers
+                  << " (queue wait: " << avg_wait_us / 1000 << " ms, cpu load: " << cpu_load
+                  << ", io ratio: " << io_ratio << ")";
+        AddWorkers(num_new_workers);
+    } else if (avg_wait_us < shrink_wait_us && queue_size == 0 && utilization < params.shrink_utilization &&
+               num_workers > params.min_workers) {
+        LOG(INFO) << "Removing render worker from " << num_workers << " (utilization: " << utilization << ")";
+        render_pool_.RemoveWorkers(1);
+    }
 }
@@ -1,6 +1,10 @@
 #pragma once
 
+#include <chrono>
+#include <condition_variable>
 #include <functional>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
 
 #include "config.h"
@@ -20,6 +24,7 @@ private:
 };
 
 using render_result_t = Metatile&&;
+using render_queue_weights_t = FairTaskQueue<TileWorkTask>::weights_t;
 
 class RenderManager {
 public:
@@ -27,9 +32,12 @@ public:
     ~RenderManager();
 
     // If this method is called from event base thread, callbacks will be called in this thread too.
+    // Render is aborted when consumer task is cancelled or destroyed.
     std::shared_ptr<RenderTask> Render(std::unique_ptr<RenderRequest> request,
                                        std::function<void(render_result_t&&)> success_callback,
-                                       std::function<void()> error_callback = std::function<void()>());
+                                       std::function<void()> error_callback = std::function<void()>(),
+                                       std::weak_ptr<const AsyncTaskBase> consumer =
+                                            std::weak_ptr<const AsyncTaskBase>());
 
     std::shared_ptr<RenderTask> MakeSubtile(std::unique_ptr<SubtileRequest> request,
                                             std::function<void(render_result_t&&)> success_callback,
@@ -37,37 +45,96 @@ public:
 
     uint GetStyleVersion(const std::string& style_name);
 
+    // nullptr if profiling is disabled
+    inline std::shared_ptr<RenderProfiler> profiler() const noexcept {
+        return profiler_;
+    }
+
     void PostStyleUpdate(std::shared_ptr<const Json::Value> jstyles);
 
     inline bool has_style(const std::string& style_name) {
-        auto active_styles = std::atomic_load(&active_styles_);
-        for (const auto& style_info : *active_styles) {
-            if (style_info.first == style_name) {
-                return true;
-            }
-        }
-        return false;
+        return styles_->GetStyle(style_name) != nullptr;
     }
 
     void WaitForInit();
 
 private:
-    void TryProcessStyleUpdate();
-    void UpdateWorker(RenderWorker& worker);
-    void FinishUpdate();
+    struct AutoscaleParams {
+        std::chrono::milliseconds interval{5000};
+        // Average queue wait which triggers growth of render pool
+        std::chrono::milliseconds grow_wait{200};
+        // Render pool can be shrinked only if average queue wait is below this value
+        std::chrono::milliseconds shrink_wait{20};
+        // Pool is not grown if process CPU load is above this fraction, unless workers are I/O bound
+        double cpu_threshold{0.9};
+        // Fraction of processing time spent waiting (not on CPU) to treat workers as I/O bound
+        double io_threshold{0.3};
+        // Pool is shrinked only if workers utilization is below this fraction
+        double shrink_utilization{0.5};
+        uint min_workers{1};
+        uint max_workers{1};
+        bool enabled{false};
+    };
+
+    struct PoolSample {
+        std::chrono::steady_clock::time_point time;
+        std::chrono::microseconds process_cpu_time;
+        std::uint64_t num_tasks;
+        std::uint64_t queue_wait_us;
+        std::uint64_t busy_us;
+        std::uint64_t cpu_us;
+    };
+
+    void StyleUpdateLoop();
+    void ProcessStyleUpdate(const Json::Value& jstyles);
+
+    // Returns nullptr if tiles should be encoded by render workers
+    inline encode_pool_t* GetEncodePool() noexcept {
+        return encode_pool_.NumWorkers() > 0 ? &encode_pool_ : nullptr;
+    }
 
-    using render_pool_t = ThreadPool<RenderWorker, TileWorkTask>;
-    using style_version_t = std::pair<std::string, uint>;
-    render_pool_t render_pool_;
-    std::shared_ptr<std::vector<style_version_t>> active_styles_;
+    void AddWorkers(uint num_workers);
+    void AutoscaleLoop();
+    void Autoscale(const PoolSample& prev_sample, const PoolSample& sample);
+    void RemoveFailedWorkers();
+    PoolSample TakeSample() const;
 
+    using render_queue_t = FairTaskQueue<TileWorkTask>;
+    using render_pool_t = ThreadPool<RenderWorker, TileWorkTask, render_queue_t>;
+    // Encode pool should be stopped after render pool
+    encode_pool_t encode_pool_;
+    render_pool_t render_pool_;
+    std::shared_ptr<StyleRegistry> styles_;
+    std::shared_ptr<RenderPoolStats> pool_stats_;
+    std::shared_ptr<RenderProfiler> profiler_;
+    // Time budget of every render, zero for unlimited
+    std::chrono::milliseconds render_time_budget_{0};
+    // UTFGrid resolution divider of every render
+    uint utfgrid_resolution_{4};
+    // Gzip level and zlib strategy of subtiles, negative level for uncompressed subtiles
+    int mvt_compression_level_{5};
+    int mvt_compression_strategy_{Z_DEFAULT_STRATEGY};
+    // Decoded data tile layers shared by render workers, nullptr if disabled
+    std::shared_ptr<DecodedLayerCache> decoded_layers_;
+    // Feature indexes of mvt tiles shared by render workers, nullptr if disabled
+    std::shared_ptr<FeatureIndexCache> feature_indexes_;
+
+    AutoscaleParams autoscale_params_;
+    std::thread autoscale_thread_;
+    std::mutex autoscale_mux_;
+    std::condition_variable autoscale_cv_;
+    std::vector<RenderWorker*> failed_workers_;
+    std::mutex failed_workers_mux_;
+    bool stop_autoscale_{false};
+
+    // Styles are loaded in separate thread, so render workers keep rendering during update
+    std::thread style_update_thread_;
+    std::mutex style_update_mux_;
+    std::condition_variable style_update_cv_;
     std::shared_ptr<const Json::Value> styles_update_;
-    std::vector<StyleInfo> pending_update_;
-    std::vector<const RenderWorker*> workers_to_update_;
-    std::vector<const RenderWorker*> updated_workers_;
+    bool stop_style_update_{false};
+
     std::unique_ptr<RSemaphore> rsem_;
-    std::atomic_bool updating_{false};
-    std::atomic_bool inited_{false};
 
     StyleUpdateObserver update_observer_;
 
@@ -1,103 +1,143 @@
 #include "renderworker.h"
 
+#include <algorithm>
+#include <ctime>
 #include <fstream>
 
 #include <mapnik/config.hpp>
 #include <mapnik/agg_renderer.hpp>
+#include <mapnik/attribute.hpp>
 #include <mapnik/grid/grid_renderer.hpp>
 #include <mapnik/grid/grid_view.hpp>
 #include <mapnik/layer.hpp>
-#include <mapnik/load_map.hpp>
 #include <mapnik/image_view.hpp>
 #include <mapnik/image_util.hpp>
-#include <mapnik/feature_type_style.hpp>
-#include <mapnik/rule.hpp>
+#include <mapnik/projection.hpp>
+#include <mapnik/scale_denominator.hpp>
 
 #include <glog/logging.h>
 
+#include <vector_tile_compression.hpp>
 #include <vector_tile_config.hpp>
 #include <vector_tile_datasource_pbf.hpp>
 
-#include <mapbox2mapnik/mapbox2mapnik.hpp>
-
 #include "cached_datasource.h"
-#include "load_map.h"
+#include "profiling_datasource.h"
+#include "render_guard.h"
+#include "solid_tile.h"
 #include "subtiler.h"
 #include "utfgrid_encode.h"
 
-static const std::string kMapProj = "+proj=merc +a=6378137 +b=6378137 +lat_ts=0.0 +lon_0=0.0 +x_0=0.0 +y_0=0.0 +k=1.0 "
-                                    "+units=m +nadgrids=@null +wktext +no_defs +over";
+static inline std::chrono::microseconds ThreadCpuTime() noexcept {
+    timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+        return std::chrono::microseconds(0);
+    }
+    return std::chrono::seconds(ts.tv_sec) + std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::nanoseconds(ts.tv_nsec));
+}
 
-RenderWorker::RenderWorker(std::shared_ptr<const styles_t> styles) : styles_(std::move(styles)) {}
+RenderWorker::RenderWorker(std::shared_ptr<const StyleRegistry> styles, std::shared_ptr<RenderPoolStats> stats,
+                           encode_pool_t* encode_pool, std::shared_ptr<DecodedLayerCache> decoded_layers,
+                           std::shared_ptr<RenderProfiler> profiler,
+                           std::shared_ptr<FeatureIndexCache> feature_indexes) :
+        styles_(std::move(styles)),
+        stats_(std::move(stats)),
+        encode_pool_(encode_pool),
+        decoded_layers_(std::move(decoded_layers)),
+        profiler_(std::move(profiler)),
+        feature_indexes_(std::move(feature_indexes)) {
+    assert(styles_);
+}
 
 bool RenderWorker::Init() noexcept {
-    if (!styles_) {
+    auto styles = styles_->styles();
+    if (!styles) {
         return true;
     }
-    for (const StyleInfo& style_info : *styles_) {
-        auto map_info = LoadStyle(style_info);
-        if (!map_info) {
-            return false;
-        }
-        maps_[style_info.name] = std::move(map_info);
-
+    for (const auto& style_itr : *styles) {
+        maps_[style_itr.first] = MakeMapInfo(style_itr.second);
     }
+    synced_styles_ = std::move(styles);
     return true;
 }
 
-std::shared_ptr<RenderWorker::MapInfo> RenderWorker::LoadStyle(const StyleInfo& style_info) {
-    if (style_info.name.empty()) {
-        LOG(ERROR) << "Empty style name";
+std::shared_ptr<RenderWorker::MapInfo> RenderWorker::MakeMapInfo(std::shared_ptr<const RenderStyle> style) {
+    auto map_info = std::make_shared<MapInfo>();
+    // Layer copies share datasources of standard layers with the style, mapnik datasources are thread safe.
+    map_info->layers = style->map().layers();
+    for (mapnik::layer& layer : map_info->layers) {
+        if (layer.datasource() == nullptr) {
+            map_info->mvt_layers.push_back(&layer);
+        } else {
+            map_info->standard_layers.push_back(&layer);
+        }
+    }
+    map_info->style = std::move(style);
+    return map_info;
+}
+
+RenderWorker::MapInfo* RenderWorker::GetMapInfo(const std::string& style_name) {
+    auto styles = styles_->styles();
+    if (!styles) {
         return nullptr;
     }
-    auto map_info = std::make_shared<MapInfo>(256, 256, kMapProj);
-    map_info->allow_grid_render = style_info.allow_grid_render;
-    map_info->version = style_info.version;
-    mapnik::Map& map = map_info->map;
-    try {
-        if (!style_info.path.empty()) {
-            sputnik::load_map(map, style_info.path);
-        } else if (style_info.data && !style_info.data->empty()){
-            if (style_info.type == StyleInfo::Type::mapnik) {
-                mapnik::load_map_string(map, *style_info.data, false, style_info.base_path);
+    if (styles != synced_styles_) {
+        // Styles were updated, drop layers of removed and changed styles
+        for (auto map_itr = maps_.begin(); map_itr != maps_.end();) {
+            auto style_itr = styles->find(map_itr->first);
+            if (style_itr == styles->end() || style_itr->second != map_itr->second->style) {
+                map_itr = maps_.erase(map_itr);
             } else {
-                sputnik::load_mapbox_map_string(map, *style_info.data, false, style_info.base_path);
+                ++map_itr;
             }
-        } else {
-            LOG(ERROR) << "No style path, nor style data provided!";
-            return nullptr;
         }
-    } catch (const std::exception& e) {
-        LOG(ERROR) << "Error while loading style: " << e.what();
+        synced_styles_ = styles;
+    }
+    auto style_itr = styles->find(style_name);
+    if (style_itr == styles->end()) {
         return nullptr;
     }
-
-    CalculateLayersSD(map);
-    // Find mvt layers (layers without ds) and set 900913 proj for them!
-    for (mapnik::layer& layer : map.layers()) {
-        if (layer.datasource() == nullptr) {
-            map_info->mvt_layers.push_back(&layer);
-            layer.set_srs(map.srs());
-        } else {
-            map_info->standard_layers.push_back(&layer);
-        }
+    std::shared_ptr<MapInfo>& map_info = maps_[style_name];
+    if (!map_info || map_info->style != style_itr->second) {
+        map_info = MakeMapInfo(style_itr->second);
     }
-    return map_info;
+    return map_info.get();
 }
 
 void RenderWorker::ProcessTask(TileWorkTask task) noexcept {
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+    const auto start_time = std::chrono::steady_clock::now();
+    if (stats_) {
+        ++stats_->num_tasks;
+        stats_->queue_wait_us += duration_cast<microseconds>(start_time - task.post_time).count();
+    }
     if (task.async_task->cancelled()) {
+        // Lets consumer finish, no-op if task itself was cancelled
+        task.async_task->NotifyError();
         return;
     }
+    if (!stats_) {
+        ProcessRequest(task);
+        return;
+    }
+    const microseconds start_cpu_time = ThreadCpuTime();
+    ProcessRequest(task);
+    stats_->cpu_us += (ThreadCpuTime() - start_cpu_time).count();
+    stats_->busy_us += duration_cast<microseconds>(std::chrono::steady_clock::now() - start_time).count();
+}
+
+void RenderWorker::ProcessRequest(TileWorkTask& task) noexcept {
     TileWorkRequest* request = task.request.get();
     RenderRequest* rr = dynamic_cast<RenderRequest*>(request);
     if (rr) {
-        ProcessRender(*task.async_task, *rr);
+        ProcessRender(task.async_task, *rr);
         return;
     }
     SubtileRequest* sr = dynamic_cast<SubtileRequest*>(request);
     if (sr) {
-        ProcessSubtile(*task.async_task, *sr);
+        ProcessSubtile(task.async_task, *sr);
         return;
     }
     LOG(ERROR) << "Invalid TileWorkRequest!";
@@ -106,21 +146,56 @@ void RenderWorker::ProcessTask(TileWorkTask task) noexcept {
 
 static inline std::string GetTileData(std::size_t x, std::size_t y,
                                       std::size_t width, std::size_t height,
-                                      const mapnik::image_rgba8& img) {
+                                      const mapnik::image_rgba8& img, const TileEncoder& encoder) {
     mapnik::image_view<mapnik::image_rgba8> view(x, y, width, height, img);
-    return mapnik::save_to_string(view, "png8:z=1");
+    std::uint32_t color;
+    if (solid_tile::IsUniform(view, color)) {
+        std::string reference = solid_tile::MakeReference(color, width, height, encoder.key());
+        // Payload is encoded here on first use, not on event base thread sending response
+        solid_tile::Resolve(reference);
+        return reference;
+    }
+    return encoder.Encode(view);
 }
 
 static inline std::string GetTileData(std::size_t x, std::size_t y, std::size_t width,
                                       std::size_t height, const mapnik::grid& grid) {
     mapnik::grid_view view = const_cast<mapnik::grid&>(grid).get_view(x, y, width, height);
-    return encode_utfgrid(view);
+    return encode_utfgrid(view, 1);
 }
 
 
-template <typename T>
-static void SplitToTiles(const T& image, Metatile& metatile) {
-    const MetatileId& metatile_id = metatile.id;
+// Renders shared map with worker's layers. Map extent and size are taken from request, so map is not modified.
+// Guard is checked before every layer. If profiles are provided (one per layer), layer times are added to them.
+template <typename Renderer>
+static void RenderLayers(const mapnik::Map& map, const std::vector<mapnik::layer>& layers,
+                         const mapnik::request& req, Renderer& ren, RenderGuard& guard,
+                         LayerProfile* profiles = nullptr) {
+    mapnik::projection map_proj(map.srs(), true);
+    const double scale_denom = mapnik::scale_denominator(req.scale(), map_proj.is_geographic()) *
+            ren.scale_factor();
+    ren.start_map_processing(map);
+    for (std::size_t i = 0; i < layers.size(); ++i) {
+        const mapnik::layer& layer = layers[i];
+        if (layer.visible(scale_denom)) {
+            guard.set_layer(layer.name());
+            guard.Check();
+            const auto layer_start_time = std::chrono::steady_clock::now();
+            std::set<std::string> names;
+            ren.apply_to_layer(layer, ren, map_proj, req.scale(), scale_denom, req.width(), req.height(),
+                               req.extent(), req.buffer_size(), names);
+            if (profiles) {
+                profiles[i].total_time += std::chrono::steady_clock::now() - layer_start_time;
+                profiles[i].rendered = true;
+            }
+        }
+    }
+    ren.end_map_processing(map);
+}
+
+// Calls fn(tile_i, x, y, width, height) for every tile area of metatile image.
+template <typename T, typename Fn>
+static void ForEachTile(const T& image, const MetatileId& metatile_id, Fn&& fn) {
     assert(image.width() % metatile_id.width() == 0);
     assert(image.height() % metatile_id.height() == 0);
     std::size_t tile_image_width = image.width() / metatile_id.width();
@@ -128,30 +203,168 @@ static void SplitToTiles(const T& image, Metatile& metatile) {
     std::size_t tile_i = 0;
     for (std::size_t y = 0; y < image.height(); y += tile_image_height) {
         for (std::size_t x = 0; x < image.width(); x += tile_image_width) {
-            assert(tile_i < metatile.tiles.size());
-            std::string& tile_data = metatile.tiles[tile_i++].data;
-            tile_data = GetTileData(x, y, tile_image_width, tile_image_height, image);
+            fn(tile_i++, x, y, tile_image_width, tile_image_height);
         }
     }
 }
 
-void RenderWorker::ProcessRender(RenderTask& async_task, const RenderRequest& request) noexcept {
-    if (async_task.cancelled()) {
+template <typename T, typename ...Args>
+static void SplitToTiles(const T& image, const MetatileId& metatile_id, std::vector<Tile>& tiles,
+                         const Args&... args) {
+    ForEachTile(image, metatile_id, [&](std::size_t tile_i, std::size_t x, std::size_t y,
+                                        std::size_t width, std::size_t height) {
+        assert(tile_i < tiles.size());
+        tiles[tile_i].data = GetTileData(x, y, width, height, image, args...);
+    });
+}
+
+static inline const char* RenderTypeName(RenderType render_type) noexcept {
+    switch (render_type) {
+    case RenderType::png:
+        return "png";
+    case RenderType::utfgrid:
+        return "utfgrid";
+    case RenderType::png_utfgrid:
+        return "png+utfgrid";
+    }
+    return "unknown";
+}
+
+
+namespace {
+
+// Wraps datasources of active layers with profiling proxies for one render and restores them after.
+class LayersProfiling {
+public:
+    LayersProfiling(std::vector<mapnik::layer>& layers) :
+            layers_(layers),
+            profiles_(layers.size()),
+            datasources_(layers.size()) {
+        for (std::size_t i = 0; i < layers_.size(); ++i) {
+            mapnik::layer& layer = layers_[i];
+            profiles_[i].name = layer.name();
+            if (layer.active() && layer.datasource()) {
+                datasources_[i] = layer.datasource();
+                layer.set_datasource(std::make_shared<ProfilingDataSource>(datasources_[i], profiles_[i]));
+            }
+        }
+    }
+
+    ~LayersProfiling() {
+        for (std::size_t i = 0; i < layers_.size(); ++i) {
+            if (datasources_[i]) {
+                layers_[i].set_datasource(datasources_[i]);
+            }
+        }
+    }
+
+    inline std::vector<LayerProfile>& profiles() noexcept {
+        return profiles_;
+    }
+
+private:
+    std::vector<mapnik::layer>& layers_;
+    std::vector<LayerProfile> profiles_;
+    std::vector<mapnik::datasource_ptr> datasources_;
+};
+
+// Shared state of metatile tiles encoded in parallel. The last encoded tile sets task result.
+struct EncodeJob {
+    EncodeJob(std::shared_ptr<RenderTask> async_task_, Metatile&& metatile_,
+              render_image_ptr_t image_, std::shared_ptr<const TileEncoder> encoder_) :
+            async_task(std::move(async_task_)),
+            metatile(std::move(metatile_)),
+            image(std::move(image_)),
+            encoder(std::move(encoder_)),
+            tiles_left(metatile.tiles.size()) {}
+
+    std::shared_ptr<RenderTask> async_task;
+    Metatile metatile;
+    // Returned to worker's surface pool when encoding is finished
+    render_image_ptr_t image;
+    // nullptr for default encoder
+    std::shared_ptr<const TileEncoder> encoder;
+    std::atomic<std::size_t> tiles_left;
+    std::atomic_bool failed{false};
+    const std::chrono::steady_clock::time_point start_time{std::chrono::steady_clock::now()};
+};
+
+// Shared state of subtiles compressed in parallel. The last compressed tile sets task result.
+struct CompressJob {
+    CompressJob(std::shared_ptr<RenderTask> async_task_, Metatile&& metatile_) :
+            async_task(std::move(async_task_)),
+            metatile(std::move(metatile_)),
+            tiles_left(metatile.tiles.size()) {}
+
+    std::shared_ptr<RenderTask> async_task;
+    Metatile metatile;
+    std::atomic<std::size_t> tiles_left;
+};
+
+// Tile is left uncompressed on compression error
+void CompressSubtile(Tile& tile, int level, int strategy) {
+    std::string compressed;
+    try {
+        mapnik::vector_tile_impl::zlib_compress(tile.data, compressed, true, level, strategy);
+    } catch (const std::runtime_error& e) {
+        LOG(ERROR) << "MVT compression error: " << e.what() << " " << tile.id;
         return;
     }
+    tile.data = std::move(compressed);
+}
+
+} // ns anonymous
+
+void RenderWorker::EncodeTiles(std::shared_ptr<RenderTask> async_task, Metatile&& metatile,
+                               render_image_ptr_t image,
+                               std::shared_ptr<const TileEncoder> encoder) {
+    auto job = std::make_shared<EncodeJob>(std::move(async_task), std::move(metatile), std::move(image),
+                                           std::move(encoder));
+    ForEachTile(*job->image, job->metatile.id, [this, &job](std::size_t tile_i, std::size_t x, std::size_t y,
+                                                           std::size_t width, std::size_t height) {
+        encode_pool_->PostTask(EncodeTask{[job, tile_i, x, y, width, height]() {
+            if (!job->failed && !job->async_task->cancelled()) {
+                try {
+                    const TileEncoder& tile_encoder = job->encoder ? *job->encoder : TileEncoder::DefaultEncoder();
+                    job->metatile.tiles[tile_i].data = GetTileData(x, y, width, height, *job->image,
+                                                                   tile_encoder);
+                } catch (const std::exception& e) {
+                    LOG(ERROR) << "Tile encoding error: " << e.what() << " " << job->metatile.id;
+                    job->failed = true;
+                }
+            }
+            if (--job->tiles_left > 0) {
+                return;
+            }
+            // Image is not needed anymore, release it before passing result
+            job->image.reset();
+            if (job->failed || job->async_task->cancelled()) {
+                job->async_task->NotifyError();
+            } else {
+                job->metatile.render_time += std::chrono::duration_cast<std::chrono::microseconds>(
+                            std::chrono::steady_clock::now() - job->start_time);
+                job->async_task->SetResult(std::move(job->metatile));
+            }
+        }});
+    });
+}
+
+void RenderWorker::ProcessRender(const std::shared_ptr<RenderTask>& async_task_ptr,
+                                 const RenderRequest& request) noexcept {
+    const auto start_time = std::chrono::steady_clock::now();
+    RenderTask& async_task = *async_task_ptr;
 
-    auto map_info_itr = maps_.find(request.style_name);
-    if (map_info_itr == maps_.end()) {
+    MapInfo* map_info_ptr = GetMapInfo(request.style_name);
+    if (!map_info_ptr) {
         LOG(ERROR) << "Style \"" << request.style_name << "\" not found!";
         async_task.NotifyError();
         return;
     }
 
-    MapInfo& map_info = *map_info_itr->second;
-    mapnik::Map& map = map_info.map;
+    MapInfo& map_info = *map_info_ptr;
+    const mapnik::Map& map = map_info.style->map();
 
     const MetatileId& metatile_id = request.metatile_id;
-    const int buf_size = 256;
     const int scale = request.retina ? 2 : 1;
     const int map_width = 256 * metatile_id.width() * scale;
     const int map_height = 256 * metatile_id.height() * scale;
@@ -162,8 +375,6 @@ void RenderWorker::ProcessRender(RenderTask& async_task, const RenderRequest& re
     metatile_req.set_buffer_size(128);
     mapnik::box2d<double> metatile_buf_bbox = metatile_req.get_buffered_extent();
 
-    map.zoom_to_box(metatile_bbox);
-
     if (request.layers == nullptr) {
         for (auto layer : map_info.standard_layers) {
             layer->set_active(true);
@@ -204,6 +415,14 @@ void RenderWorker::ProcessRender(RenderTask& async_task, const RenderRequest& re
                 }
 
                 protozero::pbf_reader layer_pbf(data_pair);
+                if (decoded_layers_ && !request.data_key.empty()) {
+                    auto decoded_layer = GetDecodedLayer(request, layer_name, layer_pbf);
+                    if (decoded_layer) {
+                        datasources[layer_name] = std::make_shared<CahedDataSource>(std::move(decoded_layer),
+                                                                                    metatile_buf_bbox);
+                        continue;
+                    }
+                }
                 auto ds = std::make_shared<mapnik::vector_tile_impl::tile_datasource_pbf>(
                         layer_pbf,
                         base_x,
@@ -217,7 +436,6 @@ void RenderWorker::ProcessRender(RenderTask& async_task, const RenderRequest& re
             for (mapnik::layer* map_layer : map_info.mvt_layers) {
                 auto ds_map_iter = datasources.find(map_layer->name());
                 if (ds_map_iter != datasources.end()) {
-                    map_layer->set_buffer_size(buf_size);
                     map_layer->set_datasource(ds_map_iter->second);
                     map_layer->set_active(true);
                 } else {
@@ -231,111 +449,185 @@ void RenderWorker::ProcessRender(RenderTask& async_task, const RenderRequest& re
         }
     }
 
-    map.resize(map_width, map_height);
+    mapnik::request render_req(map_width, map_height, metatile_bbox);
+    render_req.set_buffer_size(map.buffer_size());
+    const mapnik::attributes vars;
+
+    const bool render_image = request.render_type != RenderType::utfgrid;
+    bool render_grid = request.render_type != RenderType::png;
+    if (render_grid && !map_info.style->allow_grid_render()) {
+        if (!render_image) {
+            LOG(ERROR) << "UTFGrid rendering is not allowed for style \"" << request.style_name << "\"!";
+            async_task.NotifyError();
+            return;
+        }
+        render_grid = false;
+    }
 
-    if (async_task.cancelled()) {
-        return;
+    std::unique_ptr<LayersProfiling> profiling;
+    if (profiler_ && profiler_->ShouldSample()) {
+        profiling = std::make_unique<LayersProfiling>(map_info.layers);
     }
+    LayerProfile* layer_profiles = profiling ? profiling->profiles().data() : nullptr;
+    auto add_profile = [&]() {
+        if (profiling) {
+            profiler_->AddRender(request.style_name, metatile_id.left_top().z,
+                                 std::chrono::duration_cast<std::chrono::microseconds>(
+                                     std::chrono::steady_clock::now() - start_time),
+                                 profiling->profiles());
+        }
+    };
 
     Metatile metatile(metatile_id);
+    const auto deadline = request.time_budget.count() > 0 ? start_time + request.time_budget :
+                                                             RenderGuard::clock_t::time_point::max();
     try {
-        if (request.render_type == RenderType::png) {
-            mapnik::image_rgba8 image(map_width, map_height);
-            mapnik::agg_renderer<mapnik::image_rgba8> ren(map, image, scale);
-            ren.apply();
-            SplitToTiles(image, metatile);
-        } else {
-            mapnik::grid utf_grid(map_width, map_height, request.utfgrid_key);
-            mapnik::grid_renderer<mapnik::grid> ren(map, utf_grid, scale);
-            ren.apply();
-            SplitToTiles(utf_grid, metatile);
+        RenderGuard guard(async_task, deadline);
+        // Both renders use the same datasources, so features of data tile are decoded once
+        // and reused from cache by the second render.
+        if (render_grid) {
+            // Grid is rendered directly at output resolution with the same extent, so scale
+            // denominators of layers and styles are the same as for image.
+            const uint resolution = request.utfgrid_resolution > 0 ? request.utfgrid_resolution : 1;
+            mapnik::request grid_req(map_width / resolution, map_height / resolution, metatile_bbox);
+            grid_req.set_buffer_size((map.buffer_size() + resolution - 1) / resolution);
+            auto utf_grid = grid_pool_.Acquire(grid_req.width(), grid_req.height(), request.utfgrid_key);
+            utf_grid->set_key(request.utfgrid_key);
+            mapnik::grid_renderer<mapnik::grid> ren(map, grid_req, vars, *utf_grid,
+                                                    static_cast<double>(scale) / resolution);
+            RenderLayers(map, map_info.layers, grid_req, ren, guard, layer_profiles);
+            if (!render_image) {
+                add_profile();
+            }
+            metatile.utfgrid_tiles = metatile.tiles;
+            SplitToTiles(*utf_grid, metatile_id, metatile.utfgrid_tiles);
         }
+        if (render_image) {
+            render_image_ptr_t image = image_pool_.Acquire(map_width, map_height);
+            mapnik::agg_renderer<mapnik::image_rgba8> ren(map, render_req, vars, *image, scale);
+            RenderLayers(map, map_info.layers, render_req, ren, guard, layer_profiles);
+            add_profile();
+            if (encode_pool_ && metatile.tiles.size() > 1) {
+                // Encoding time is added by the last encoded tile
+                metatile.render_time = std::chrono::duration_cast<std::chrono::microseconds>(
+                            std::chrono::steady_clock::now() - start_time);
+                EncodeTiles(async_task_ptr, std::move(metatile), std::move(image), request.tile_encoder);
+                return;
+            }
+            SplitToTiles(*image, metatile_id, metatile.tiles,
+                         request.tile_encoder ? *request.tile_encoder : TileEncoder::DefaultEncoder());
+        }
+    } catch (const RenderAborted& e) {
+        if (e.timed_out()) {
+            LOG(WARNING) << "Render aborted: " << e.what() << " style: " << request.style_name << " type: " <<
+                            RenderTypeName(request.render_type) << metatile_id;
+        }
+        async_task.NotifyError();
+        return;
     } catch(const std::exception& e) {
         LOG(ERROR) << "Mapnik render error: " << e.what() << " type: " <<
-                      (request.render_type == RenderType::png ? "png" : "utfgrid") << metatile_id;
+                      RenderTypeName(request.render_type) << metatile_id;
         async_task.NotifyError();
         return;
     }
+    metatile.render_time = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start_time);
     async_task.SetResult(std::move(metatile));
 }
 
-void RenderWorker::ProcessSubtile(RenderTask& async_task, SubtileRequest& request) noexcept {
-    const int buf_size = 256;
-    Subtiler subtiler(std::move(request.mvt_tile), request.filter_table);
-    std::string result;
-    try {
-        result = subtiler.MakeSubtile(request.tile_id, 4096, buf_size, std::move(request.layers));
-    } catch (...) {
-        LOG(ERROR) << "MVT subtiling error: " << request.tile_id;
-        async_task.NotifyError();
-        return;
+std::shared_ptr<const DecodedLayer> RenderWorker::GetDecodedLayer(const RenderRequest& request,
+                                                                  const std::string& layer_name,
+                                                                  protozero::pbf_reader layer_pbf) {
+    const TileId& data_tile_id = request.data_tile->id;
+    std::string key = request.data_key + '/' + std::to_string(data_tile_id.z) + '/' +
+            std::to_string(data_tile_id.x) + '/' + std::to_string(data_tile_id.y) + '/' + layer_name;
+    auto decoded_layer = decoded_layers_->Get(key);
+    if (decoded_layer) {
+        return decoded_layer;
     }
-    Metatile metatile;
-    metatile.id = MetatileId(request.tile_id);
-    metatile.tiles.push_back(Tile{request.tile_id, std::move(result)});
-    async_task.SetResult(std::move(metatile));
+    // Layer is decoded without lock, concurrent renders of the same data tile may decode it twice
+    decoded_layer = DecodedLayer::Decode(layer_pbf, data_tile_id);
+    if (decoded_layer) {
+        decoded_layers_->Set(key, decoded_layer);
+    }
+    return decoded_layer;
 }
 
-void RenderWorker::CalculateLayersSD(mapnik::Map& map) {
-    const auto& styles = map.styles();
-    for (auto &layer : map.layers()) {
-        double min_sd = 1000000000;
-        double max_sd = 0;
-        for (const auto &style_name : layer.styles()) {
-            const auto style_itr = styles.find(style_name);
-            if (style_itr == styles.end()) {
-                continue;
+void RenderWorker::CompressSubtiles(std::shared_ptr<RenderTask> async_task, Metatile&& metatile,
+                                    int level, int strategy) {
+    auto job = std::make_shared<CompressJob>(std::move(async_task), std::move(metatile));
+    for (std::size_t tile_i = 0; tile_i < job->metatile.tiles.size(); ++tile_i) {
+        encode_pool_->PostTask(EncodeTask{[job, tile_i, level, strategy]() {
+            if (!job->async_task->cancelled()) {
+                CompressSubtile(job->metatile.tiles[tile_i], level, strategy);
             }
-            const auto& style = style_itr->second;
-            for (const auto &rule : style.get_rules()) {
-                min_sd = std::min(min_sd, rule.get_min_scale());
-                max_sd = std::max(max_sd, rule.get_max_scale());
+            if (--job->tiles_left > 0) {
+                return;
             }
-        }
-        if (min_sd != 1000000000) {
-            layer.set_minimum_scale_denominator(min_sd);
-        }
-        if (max_sd != 0) {
-            layer.set_maximum_scale_denominator(max_sd);
-        }
+            if (job->async_task->cancelled()) {
+                job->async_task->NotifyError();
+            } else {
+                job->async_task->SetResult(std::move(job->metatile));
+            }
+        }});
     }
 }
 
-bool RenderWorker::UpdateStyles(const styles_t& styles) {
-    pending_update_ptr_ = &styles;
-    for (const StyleInfo& style_info : styles) {
-        auto map_info_itr = maps_.find(style_info.name);
-        if (map_info_itr != maps_.end()) {
-            std::shared_ptr<MapInfo>& map_info = map_info_itr->second;
-            if (map_info->version == style_info.version) {
-                updated_maps_[style_info.name] = map_info;
-                continue;
-            }
-        }
-        auto map_info = LoadStyle(style_info);
-        if (!map_info) {
-            return false;
+void RenderWorker::ProcessSubtile(const std::shared_ptr<RenderTask>& async_task_ptr,
+                                  SubtileRequest& request) noexcept {
+    RenderTask& async_task = *async_task_ptr;
+    const int buf_size = 256;
+    const TileId base_tile_id = request.mvt_tile.id;
+    std::vector<TileId> target_ids;
+    for (const TileId& tile_id : request.metatile_id.TileIds()) {
+        if (tile_id.z >= base_tile_id.z && GetUpperZoom(tile_id, tile_id.z - base_tile_id.z) == base_tile_id) {
+            target_ids.push_back(tile_id);
         }
-        updated_maps_[style_info.name] = std::move(map_info);
     }
-    return true;
-}
+    if (std::find(target_ids.begin(), target_ids.end(), request.tile_id) == target_ids.end()) {
+        target_ids.assign(1, request.tile_id);
+    }
 
-bool RenderWorker::CommitUpdate(const styles_t* update_ptr) {
-    if (pending_update_ptr_ != update_ptr) {
-        return false;
+    std::string index_key;
+    std::shared_ptr<const TileFeatureIndex> feature_index;
+    if (feature_indexes_ && !request.data_key.empty()) {
+        index_key = request.data_key + '/' + std::to_string(base_tile_id.z) + '/' +
+                std::to_string(base_tile_id.x) + '/' + std::to_string(base_tile_id.y);
+        feature_index = feature_indexes_->Get(index_key);
     }
-    maps_.clear();
-    maps_.swap(updated_maps_);
-    pending_update_ptr_ = nullptr;
-    return true;
-}
+    const bool index_cached = feature_index != nullptr;
 
-bool RenderWorker::CancelUpdate(const styles_t* update_ptr) {
-    if (pending_update_ptr_ != update_ptr) {
-        return false;
+    Subtiler subtiler(std::move(request.mvt_tile), request.filter_table, std::move(feature_index));
+    std::vector<std::string> results;
+    try {
+        results = subtiler.MakeSubtiles(target_ids, 4096, buf_size, std::move(request.layers));
+    } catch (...) {
+        LOG(ERROR) << "MVT subtiling error: " << request.tile_id;
+        async_task.NotifyError();
+        return;
     }
-    updated_maps_.clear();
-    pending_update_ptr_ = nullptr;
-    return true;
+    if (!index_key.empty() && !index_cached && subtiler.feature_index()) {
+        feature_indexes_->Set(index_key, subtiler.feature_index());
+    }
+    if (results.size() != target_ids.size()) {
+        LOG(ERROR) << "MVT subtiling error: " << request.tile_id;
+        async_task.NotifyError();
+        return;
+    }
+    Metatile metatile;
+    metatile.id = target_ids.size() > 1 ? request.metatile_id : MetatileId(request.tile_id);
+    for (std::size_t i = 0; i < target_ids.size(); ++i) {
+        metatile.tiles.push_back(Tile{target_ids[i], std::move(results[i])});
+    }
+    if (request.compression_level >= 0) {
+        if (encode_pool_ && metatile.tiles.size() > 1) {
+            CompressSubtiles(async_task_ptr, std::move(metatile), request.compression_level,
+                             request.compression_strategy);
+            return;
+        }
+        for (Tile& tile : metatile.tiles) {
+            CompressSubtile(tile, request.compression_level, request.compression_strategy);
+        }
+    }
+    async_task.SetResult(std::move(metatile));
 }
@@ -1,19 +1,32 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <list>
 #include <set>
 #include <string>
 
+#include <mapnik/image.hpp>
 #include <mapnik/map.hpp>
+#include <zlib.h>
 
 #include "async_task.h"
+#include "decoded_layer.h"
+#include "encode_worker.h"
+#include "feature_index.h"
 #include "filter_table.h"
+#include "render_profiler.h"
+#include "render_style.h"
+#include "surface_pool.h"
 #include "tile.h"
+#include "tile_encoder.h"
 #include "worker.h"
 
 enum class RenderType : std::uint8_t {
     png,
-    utfgrid
+    utfgrid,
+    // Image and utfgrid rendered from the same data in one pass
+    png_utfgrid
 };
 
 struct TileWorkRequest {
@@ -30,7 +43,15 @@ struct RenderRequest : public TileWorkRequest {
     std::string style_name;
     std::string utfgrid_key;
     std::shared_ptr<Tile> data_tile;
+    // Data provider name and version of data tile, decoded layers of data tile are cached by it
+    std::string data_key;
     std::unique_ptr<std::set<std::string>> layers;
+    // Render is aborted when it takes longer, zero for unlimited
+    std::chrono::milliseconds time_budget{0};
+    // UTFGrid is rendered at 1/utfgrid_resolution of image size, zero for default
+    uint utfgrid_resolution{0};
+    // Encoder of png tiles, default encoder is used if not set
+    std::shared_ptr<const TileEncoder> tile_encoder;
     RenderType render_type{RenderType::png};
     bool retina{false};
 };
@@ -41,70 +62,99 @@ struct SubtileRequest : public TileWorkRequest {
 
     SubtileRequest(Tile mvt_tile_, TileId tile_id_) :
         mvt_tile(std::move(mvt_tile_)),
-        tile_id(tile_id_) {}
+        tile_id(tile_id_),
+        metatile_id(tile_id_) {}
 
     Tile mvt_tile;
     TileId tile_id;
+    // Tiles of metatile covered by mvt tile are made together with requested tile
+    MetatileId metatile_id;
+    // Data provider name and version of mvt tile, feature index of mvt tile is cached by it
+    std::string data_key;
     std::shared_ptr<FilterTable> filter_table;
     std::unique_ptr<std::set<std::string>> layers;
+    // Gzip level of subtiles, negative for uncompressed subtiles
+    int compression_level{-1};
+    int compression_strategy{Z_DEFAULT_STRATEGY};
 };
 
 using RenderTask = AsyncTask<Metatile&&>;
+using render_image_ptr_t = SurfacePool<mapnik::image_rgba8>::surface_ptr;
 
 struct TileWorkTask {
     std::shared_ptr<RenderTask> async_task;
     std::unique_ptr<TileWorkRequest> request;
+    // Render pool sub-queue: style name for render requests, reserved key for subtile requests
+    std::string queue_key;
+    std::chrono::steady_clock::time_point post_time;
 };
 
-struct StyleInfo {
-    enum class Type : std::uint8_t {
-        mapnik,
-        mvt
-    };
-
-    std::string name;
-    std::string path;
-    std::string base_path;
-    std::shared_ptr<std::string> data;
-    uint version{0};
-    Type type{Type::mapnik};
-    bool allow_grid_render{false};
+// Counters shared by all render workers. Used for render pool autoscaling.
+struct RenderPoolStats {
+    std::atomic<std::uint64_t> num_tasks{0};
+    std::atomic<std::uint64_t> queue_wait_us{0};
+    // Wall time spent processing tasks
+    std::atomic<std::uint64_t> busy_us{0};
+    // CPU time spent processing tasks. Difference with busy time is time spent waiting
+    // for I/O (e.g. PostGIS queries).
+    std::atomic<std::uint64_t> cpu_us{0};
 };
 
-
 class RenderWorker : public Worker<TileWorkTask> {
 public:
-    using styles_t = std::vector<StyleInfo>;
-
-    RenderWorker(std::shared_ptr<const styles_t> styles = nullptr);
+    // If encode pool is provided, tiles of rendered png metatiles and subtiles are encoded in parallel in this pool.
+    // If decoded layers cache is provided, decoded layers of data tiles are kept between renders.
+    // If profiler is provided, layer costs of sampled renders are reported to it.
+    // If feature indexes cache is provided, feature indexes of mvt tiles are kept between subtile requests.
+    RenderWorker(std::shared_ptr<const StyleRegistry> styles,
+                 std::shared_ptr<RenderPoolStats> stats = nullptr,
+                 encode_pool_t* encode_pool = nullptr,
+                 std::shared_ptr<DecodedLayerCache> decoded_layers = nullptr,
+                 std::shared_ptr<RenderProfiler> profiler = nullptr,
+                 std::shared_ptr<FeatureIndexCache> feature_indexes = nullptr);
 
     bool Init() noexcept override;
     virtual void ProcessTask(TileWorkTask task) noexcept override;
 
-    static void CalculateLayersSD(mapnik::Map& map);
-
-    bool UpdateStyles(const styles_t& styles);
-    bool CommitUpdate(const styles_t* update_ptr);
-    bool CancelUpdate(const styles_t* update_ptr);
-
 private:
+    // Worker's own state for shared style: copies of style layers, which datasources (for mvt layers)
+    // and active flags are changed before every render.
     struct MapInfo {
-        MapInfo(int width, int height, std::string const& srs) : map(width, height, srs) {}
-
-        mapnik::Map map;
+        std::shared_ptr<const RenderStyle> style;
+        std::vector<mapnik::layer> layers;
         std::vector<mapnik::layer*> mvt_layers;
         std::vector<mapnik::layer*> standard_layers;
-        uint version{0};
-        bool allow_grid_render{false};
     };
 
-    std::shared_ptr<MapInfo> LoadStyle(const StyleInfo& style_info);
-    void ProcessRender(RenderTask& async_task, const RenderRequest& render_request) noexcept;
-    void ProcessSubtile(RenderTask& async_task, SubtileRequest& subtile_request) noexcept;
+    static std::shared_ptr<MapInfo> MakeMapInfo(std::shared_ptr<const RenderStyle> style);
+    MapInfo* GetMapInfo(const std::string& style_name);
+    void ProcessRequest(TileWorkTask& task) noexcept;
+    void ProcessRender(const std::shared_ptr<RenderTask>& async_task_ptr,
+                       const RenderRequest& render_request) noexcept;
+    void EncodeTiles(std::shared_ptr<RenderTask> async_task, Metatile&& metatile,
+                     render_image_ptr_t image,
+                     std::shared_ptr<const TileEncoder> encoder);
+    void ProcessSubtile(const std::shared_ptr<RenderTask>& async_task_ptr,
+                        SubtileRequest& subtile_request) noexcept;
+    void CompressSubtiles(std::shared_ptr<RenderTask> async_task, Metatile&& metatile,
+                          int level, int strategy);
+    std::shared_ptr<const DecodedLayer> GetDecodedLayer(const RenderRequest& request, const std::string& layer_name,
+                                                        protozero::pbf_reader layer_pbf);
 
     std::unordered_map<std::string, std::shared_ptr<MapInfo>> maps_;
-    std::unordered_map<std::string, std::shared_ptr<MapInfo>> updated_maps_;
-    std::shared_ptr<const styles_t> styles_;
-    const styles_t* pending_update_ptr_{nullptr};
+    std::shared_ptr<const StyleRegistry> styles_;
+    // Styles snapshot maps_ were synced with
+    std::shared_ptr<const StyleRegistry::styles_t> synced_styles_;
+    std::shared_ptr<RenderPoolStats> stats_;
+    encode_pool_t* encode_pool_;
+    // Render surfaces are reused to avoid allocating and page faulting multi-megabyte buffers on every render
+    SurfacePool<mapnik::image_rgba8> image_pool_;
+    SurfacePool<mapnik::grid> grid_pool_;
+    // Metatiles of upper zooms share data tile, so its layers are decoded once for all of them.
+    // Cache is shared by all workers, as neighbouring metatiles are usually rendered by different workers.
+    std::shared_ptr<DecodedLayerCache> decoded_layers_;
+    std::shared_ptr<RenderProfiler> profiler_;
+    // Subtiles of the same mvt tile are requested one by one, so its feature index is built once for all of them
+    std::shared_ptr<FeatureIndexCache> feature_indexes_;
 
 };
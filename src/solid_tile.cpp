@@ -0,0 +1,99 @@
+#include "solid_tile.h"
+
+#include <cstdio>
+#include <mutex>
+
+#include <mapnik/image_util.hpp>
+
+#include <glog/logging.h>
+
+#include "lru_cache.h"
+
+
+namespace solid_tile {
+
+// Retina tile, larger references are not encoded
+static const std::size_t kMaxTileSize = 512;
+static const std::size_t kPayloadsCacheCapacity = 1024;
+
+bool IsUniform(const mapnik::image_view<mapnik::image_rgba8>& view, std::uint32_t& color) noexcept {
+    const std::size_t width = view.width();
+    const std::size_t height = view.height();
+    if (width == 0 || height == 0) {
+        return false;
+    }
+    const std::uint32_t first_pixel = view.get_row(0)[0];
+    for (std::size_t y = 0; y < height; ++y) {
+        const std::uint32_t* row = view.get_row(y);
+        // Branchless accumulation lets compiler vectorize the loop
+        std::uint32_t diff = 0;
+        for (std::size_t x = 0; x < width; ++x) {
+            diff |= row[x] ^ first_pixel;
+        }
+        if (diff != 0) {
+            return false;
+        }
+    }
+    color = first_pixel;
+    return true;
+}
+
+std::string MakeReference(std::uint32_t color, std::size_t width, std::size_t height, const std::string& format) {
+    // Pixels of image_rgba8 hold r in the lowest byte
+    char color_str[9];
+    std::snprintf(color_str, sizeof(color_str), "%02x%02x%02x%02x",
+                  color & 0xff, (color >> 8) & 0xff, (color >> 16) & 0xff, (color >> 24) & 0xff);
+    std::string reference = kReferencePrefix;
+    reference.append(color_str);
+    reference.append("/");
+    reference.append(std::to_string(width));
+    reference.append("x");
+    reference.append(std::to_string(height));
+    reference.append("/");
+    reference.append(format);
+    return reference;
+}
+
+static std::shared_ptr<const std::string> Encode(const std::string& reference) {
+    unsigned r, g, b, a;
+    std::size_t width, height;
+    int format_pos = 0;
+    if (std::sscanf(reference.c_str() + kReferencePrefixSize, "%2x%2x%2x%2x/%zux%zu/%n",
+                    &r, &g, &b, &a, &width, &height, &format_pos) != 6 || format_pos == 0) {
+        return nullptr;
+    }
+    if (width == 0 || height == 0 || width > kMaxTileSize || height > kMaxTileSize) {
+        return nullptr;
+    }
+    const std::string format = reference.substr(kReferencePrefixSize + format_pos);
+    mapnik::image_rgba8 image(width, height);
+    image.set(r | (g << 8) | (b << 16) | (a << 24));
+    try {
+        return std::make_shared<std::string>(mapnik::save_to_string(image, format));
+    } catch (const std::exception& e) {
+        LOG(ERROR) << "Error while encoding solid tile " << reference << ": " << e.what();
+        return nullptr;
+    }
+}
+
+std::shared_ptr<const std::string> Resolve(const std::string& reference) {
+    static std::mutex mux;
+    static LRUCache<std::shared_ptr<const std::string>> payloads(kPayloadsCacheCapacity);
+    {
+        std::lock_guard<std::mutex> lock(mux);
+        auto payload = payloads.Get(reference);
+        if (payload) {
+            return *payload;
+        }
+    }
+    auto payload = Encode(reference);
+    if (!payload) {
+        LOG(ERROR) << "Invalid solid tile reference: " << reference;
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(mux);
+    payloads.Set(reference, payload);
+    return payload;
+}
+
+} // ns solid_tile
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <mapnik/image.hpp>
+#include <mapnik/image_view.hpp>
+
+
+// Uniform (solid color or fully transparent) tiles are not encoded by render workers. Instead tile data
+// holds a short reference "@solid/<rrggbbaa>/<width>x<height>/<format>", which is also what goes
+// to the caches. Reference is resolved to encoded payload right before sending response, payloads
+// are encoded once and shared by all responses.
+namespace solid_tile {
+
+constexpr char kReferencePrefix[] = "@solid/";
+constexpr std::size_t kReferencePrefixSize = sizeof(kReferencePrefix) - 1;
+
+// Returns true and sets color (pixel value) if all pixels of view are equal
+bool IsUniform(const mapnik::image_view<mapnik::image_rgba8>& view, std::uint32_t& color) noexcept;
+
+// Format is mapnik format string used for encoding
+std::string MakeReference(std::uint32_t color, std::size_t width, std::size_t height, const std::string& format);
+
+inline bool IsReference(const std::string& data) noexcept {
+    return data.compare(0, kReferencePrefixSize, kReferencePrefix) == 0;
+}
+
+// Returns encoded payload of referenced tile or nullptr if reference is invalid. Payload is encoded
+// on cache miss, so render workers resolve references they make and responses mostly hit the cache.
+std::shared_ptr<const std::string> Resolve(const std::string& reference);
+
+} // ns solid_tile
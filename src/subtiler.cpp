@@ -10,28 +10,52 @@
 #include <clipper.hpp>
 
 #include "bbox_clipper.h"
-#include "util.h"
 
-Subtiler::Subtiler(const Tile& base_tile, std::shared_ptr<const FilterTable> filter_table) :
+Subtiler::Subtiler(const Tile& base_tile, std::shared_ptr<const FilterTable> filter_table,
+                   std::shared_ptr<const TileFeatureIndex> feature_index) :
         base_tile_(base_tile),
         filter_table_(filter_table),
+        feature_index_(std::move(feature_index)),
         transcoder_("utf-8") {}
 
-Subtiler::Subtiler(Tile&& base_tile, std::shared_ptr<const FilterTable> filter_table) :
+Subtiler::Subtiler(Tile&& base_tile, std::shared_ptr<const FilterTable> filter_table,
+                   std::shared_ptr<const TileFeatureIndex> feature_index) :
         base_tile_(std::move(base_tile)),
         filter_table_(filter_table),
+        feature_index_(std::move(feature_index)),
         transcoder_("utf-8") {
 }
 
 std::string Subtiler::MakeSubtile(const TileId& target_tile_id,
                                   uint target_extent, int buffer_size,
                                   std::unique_ptr<std::set<std::string>> layers) {
-    std::string result;
+    std::vector<std::string> results = MakeSubtiles({target_tile_id}, target_extent, buffer_size, std::move(layers));
+    if (results.empty()) {
+        return "";
+    }
+    return std::move(results.front());
+}
+
+std::vector<std::string> Subtiler::MakeSubtiles(const std::vector<TileId>& target_tile_ids,
+                                                uint target_extent, int buffer_size,
+                                                std::unique_ptr<std::set<std::string>> layers) {
+    if (target_tile_ids.empty()) {
+        return {};
+    }
+    const uint target_zoom = target_tile_ids.front().z;
+    for (const TileId& target_tile_id : target_tile_ids) {
+        if (target_tile_id.z != target_zoom || target_zoom < base_tile_.id.z) {
+            LOG(ERROR) << "Invalid subtile " << target_tile_id << " of tile " << base_tile_.id;
+            return {};
+        }
+    }
+
     target_extent_ = target_extent;
-    zoom_factor_ = std::pow(2, target_tile_id.z - base_tile_.id.z);
+    zoom_factor_ = std::pow(2, target_zoom - base_tile_.id.z);
     clip_box_ = mapnik::box2d<int64_t>(-buffer_size , -buffer_size,
                                        target_extent + buffer_size, target_extent + buffer_size);
 
+    clip_polygon_.clear();
     clip_polygon_.reserve(5);
     clip_polygon_.emplace_back(clip_box_.minx(), clip_box_.miny());
     clip_polygon_.emplace_back(clip_box_.maxx(), clip_box_.miny());
@@ -39,23 +63,32 @@ std::string Subtiler::MakeSubtile(const TileId& target_tile_id,
     clip_polygon_.emplace_back(clip_box_.minx(), clip_box_.maxy());
     clip_polygon_.emplace_back(clip_box_.minx(), clip_box_.miny());
 
-//    result.reserve(tile_data_.size() / zoom_factor);
-
-    protozero::pbf_reader tile_message(base_tile_.data);
-    protozero::pbf_writer result_pbf(result);
-
     const FilterTable::filter_map_t* filter_map = nullptr;
     if (filter_table_) {
-        filter_map = filter_table_->GetFiltersMap(target_tile_id.z);
+        filter_map = filter_table_->GetFiltersMap(target_zoom);
         if (!filter_map) {
-            LOG(ERROR) << "Filter map not found for zoom: " << std::to_string(target_tile_id.z);
-            return "";
+            LOG(ERROR) << "Filter map not found for zoom: " << std::to_string(target_zoom);
+            return std::vector<std::string>(target_tile_ids.size());
         }
     }
 
+    // Writers refer to target data, so targets vector is not resized after writers are made
+    std::vector<Target> targets(target_tile_ids.size());
+    for (std::size_t i = 0; i < targets.size(); ++i) {
+        targets[i].tile_id = target_tile_ids[i];
+        targets[i].tile_pbf = std::make_unique<protozero::pbf_writer>(targets[i].data);
+    }
+
+    if (!feature_index_) {
+        feature_index_ = TileFeatureIndex::Build(base_tile_.data);
+    }
+
+    protozero::pbf_reader tile_message(base_tile_.data);
+
     // loop through the layers of the tile!
-    while (tile_message.next(mapnik::vector_tile_impl::Tile_Encoding::LAYERS))
+    for (std::size_t layer_i = 0; tile_message.next(mapnik::vector_tile_impl::Tile_Encoding::LAYERS); ++layer_i)
     {
+        const TileFeatureIndex::Layer* layer_index = feature_index_->layer(layer_i);
         auto data_pair = tile_message.get_data();
         protozero::pbf_reader layer_message(data_pair);
         if (!layer_message.next(mapnik::vector_tile_impl::Layer_Encoding::NAME))
@@ -73,7 +106,8 @@ std::string Subtiler::MakeSubtile(const TileId& target_tile_id,
             if (filter_itr == filter_map->end()) {
                 continue;
             }
-            layer_filter_ = filter_itr->second;
+            layer_filter_ = filter_itr->second.expression;
+            compiled_filter_ = filter_itr->second.compiled;
         }
         if (!layer_message.next(mapnik::vector_tile_impl::Layer_Encoding::EXTENT))
         {
@@ -81,24 +115,51 @@ std::string Subtiler::MakeSubtile(const TileId& target_tile_id,
             continue;
         }
         uint layer_extent = layer_message.get_uint32();
-        UpdateTargetParams(target_tile_id.x, target_tile_id.y, layer_extent, target_extent);
-//        std::cout << clipping_box_ << std::endl;
+        bool layer_intersects = layer_index == nullptr;
+        for (Target& target : targets) {
+            UpdateTargetParams(&target, layer_extent);
+            if (layer_index && layer_index->bbox.valid() && layer_index->bbox.intersects(target.source_bbox)) {
+                layer_intersects = true;
+            }
+        }
+        if (!layer_intersects) {
+            continue;
+        }
         protozero::pbf_reader layer_pbf(data_pair);
-        ProcessLayer(&layer_pbf, &result_pbf);
+        ProcessLayer(&layer_pbf, layer_index, &targets);
     }
-    return result;
+
+    std::vector<std::string> results;
+    results.reserve(targets.size());
+    for (Target& target : targets) {
+        target.tile_pbf.reset();
+        results.push_back(std::move(target.data));
+    }
+    return results;
 }
 
-void Subtiler::UpdateTargetParams(uint target_x, uint target_y, uint source_extent, uint target_extent) {
-    target_scale_ = target_extent * zoom_factor_ / static_cast<double>(source_extent);
-    target_offset_x_ = static_cast<int>(std::round((target_x / static_cast<float>(zoom_factor_)
+void Subtiler::UpdateTargetParams(Target* target, uint source_extent) const {
+    target->scale = target_extent_ * zoom_factor_ / static_cast<double>(source_extent);
+    target->offset_x = static_cast<int>(std::round((target->tile_id.x / static_cast<float>(zoom_factor_)
                                                     - base_tile_.id.x) * source_extent));
-    target_offset_y_ = static_cast<int>(std::round((target_y / static_cast<float>(zoom_factor_)
+    target->offset_y = static_cast<int>(std::round((target->tile_id.y / static_cast<float>(zoom_factor_)
                                                     - base_tile_.id.y) * source_extent));
+    // Clip box in layer coordinates with a margin for rounding
+    target->source_bbox.init(target->offset_x + static_cast<int64_t>(std::floor(clip_box_.minx() / target->scale)) - 1,
+                             target->offset_y + static_cast<int64_t>(std::floor(clip_box_.miny() / target->scale)) - 1,
+                             target->offset_x + static_cast<int64_t>(std::ceil(clip_box_.maxx() / target->scale)) + 1,
+                             target->offset_y + static_cast<int64_t>(std::ceil(clip_box_.maxy() / target->scale)) + 1);
+}
+
+void Subtiler::SetTarget(const Target& target) noexcept {
+    target_scale_ = target.scale;
+    target_offset_x_ = target.offset_x;
+    target_offset_y_ = target.offset_y;
 }
 
 
-void Subtiler::ProcessLayer(protozero::pbf_reader *layer_pbf, protozero::pbf_writer *output_pbf)
+void Subtiler::ProcessLayer(protozero::pbf_reader *layer_pbf, const TileFeatureIndex::Layer* layer_index,
+                            std::vector<Target>* targets)
 {
     using Layer_Encoding = mapnik::vector_tile_impl::Layer_Encoding;
     using Value_Encoding = mapnik::vector_tile_impl::Value_Encoding;
@@ -108,7 +169,6 @@ void Subtiler::ProcessLayer(protozero::pbf_reader *layer_pbf, protozero::pbf_wri
     uint version = 0;
 
     std::vector<protozero::pbf_reader> features;
-    protozero::pbf_writer output_layer_pbf(*output_pbf, mapnik::vector_tile_impl::Tile_Encoding::LAYERS);
 
     layer_keys_.clear();
     layer_values_.clear();
@@ -124,17 +184,16 @@ void Subtiler::ProcessLayer(protozero::pbf_reader *layer_pbf, protozero::pbf_wri
                 features.push_back(layer_pbf->get_message());
                 break;
             case Layer_Encoding::KEYS:
-                if (layer_filter_ == nullptr) {
-                    keys.push_back(layer_pbf->get_data());
-                } else {
-                    layer_keys_.push_back(layer_pbf->get_string());
+                keys.push_back(layer_pbf->get_data());
+                if (layer_filter_ != nullptr) {
+                    layer_keys_.emplace_back(keys.back().first, keys.back().second);
                 }
                 break;
             case Layer_Encoding::VALUES:
-                if (layer_filter_ == nullptr) {
-                    values.push_back(layer_pbf->get_data());
-                } else {
-                    protozero::pbf_reader val_msg = layer_pbf->get_message();
+                // Values are copied to subtiles as is, they are decoded only for filters
+                values.push_back(layer_pbf->get_data());
+                if (layer_filter_ != nullptr) {
+                    protozero::pbf_reader val_msg(values.back());
                     while (val_msg.next())
                     {
                         switch(val_msg.tag()) {
@@ -179,102 +238,149 @@ void Subtiler::ProcessLayer(protozero::pbf_reader *layer_pbf, protozero::pbf_wri
 
     num_keys_ = layer_keys_.size();
     num_values_ = layer_values_.size();
-    std::unordered_map<mapnik::value, std::size_t> layer_new_tags;
-    bool features_written = false;
-    for (auto feature_pbf : features) {
-        if (ProcessFeature(&feature_pbf, &layer_new_tags, &output_layer_pbf)) {
-            features_written = true;
+
+    layer_compiled_filter_.reset();
+    if (layer_filter_ != nullptr) {
+        // Dictionary values are decoded once per layer instead of tags of every feature
+        layer_mapnik_values_.clear();
+        layer_mapnik_values_.reserve(num_values_);
+        to_mapnik_value_visitor to_value{transcoder_};
+        for (const auto& value : layer_values_) {
+            layer_mapnik_values_.push_back(mapnik::util::apply_visitor(to_value, value));
+        }
+        if (compiled_filter_ != nullptr) {
+            layer_compiled_filter_ = std::make_unique<CompiledFilter::LayerFilter>(compiled_filter_, layer_keys_,
+                                                                                   layer_mapnik_values_);
         }
     }
 
-    if (!features_written) {
-//        std::cout << "Skipped layer " << std::string(name.first, name.second) << std::endl;
-        output_layer_pbf.rollback();
-        return;
+    for (Target& target : *targets) {
+        target.layer_pbf = std::make_unique<protozero::pbf_writer>(*target.tile_pbf,
+                                                                   Layer_Encoding::LAYERS);
+        if (layer_filter_ != nullptr) {
+            target.value_ids.assign(values.size(), -1);
+            target.values_order.clear();
+        }
+        target.features_written = false;
     }
 
-    output_layer_pbf.add_message(Layer_Encoding::NAME, name);
+    if (layer_index && layer_index->features.size() != features.size()) {
+        LOG(ERROR) << "Feature index does not match layer " << name;
+        layer_index = nullptr;
+    }
 
-    if (layer_filter_ == nullptr) {
-        for (const auto &key : keys) {
-            output_layer_pbf.add_message(Layer_Encoding::KEYS, key.first, key.second);
+    std::vector<Target*> feature_targets;
+    feature_targets.reserve(targets->size());
+    ParsedFeature feature;
+    for (std::size_t feature_i = 0; feature_i < features.size(); ++feature_i) {
+        // Features outside of all targets are skipped before tags and geometry are decoded
+        feature_targets.clear();
+        for (Target& target : *targets) {
+            if (!layer_index || layer_index->features[feature_i].intersects(target.source_bbox)) {
+                feature_targets.push_back(&target);
+            }
         }
-        for (const auto &value : values) {
-            output_layer_pbf.add_message(Layer_Encoding::VALUES, value.first, value.second);
+        if (feature_targets.empty()) {
+            continue;
         }
-    } else {
-        for (const auto &key : layer_keys_) {
-            output_layer_pbf.add_message(Layer_Encoding::KEYS, key);
-        }
-        std::vector<mapnik::value> tags_vector;
-        std::size_t num_tags = layer_new_tags.size();
-        tags_vector.resize(num_tags);
-        for (auto& tag_itr : layer_new_tags) {
-            if (tag_itr.second < num_tags) {
-                tags_vector[tag_itr.second] = std::move(tag_itr.first);
-            } else {
-                LOG(ERROR) << "Invalid tag value index " << tag_itr.second << " in layer " << name;
+        feature.Clear();
+        if (!ParseFeature(&features[feature_i], &feature)) {
+            continue;
+        }
+        for (Target* target_ptr : feature_targets) {
+            Target& target = *target_ptr;
+            SetTarget(target);
+            if (WriteFeature(feature, &target)) {
+                target.features_written = true;
             }
         }
-        for (const auto& tag_itr : tags_vector) {
-            protozero::pbf_writer value_writer(output_layer_pbf, Layer_Encoding::VALUES);
-            to_tile_value_pbf visitor(value_writer);
-            mapnik::util::apply_visitor(visitor, tag_itr);
+    }
+
+    for (Target& target : *targets) {
+        protozero::pbf_writer& output_layer_pbf = *target.layer_pbf;
+        if (!target.features_written) {
+            output_layer_pbf.rollback();
+            target.layer_pbf.reset();
+            continue;
         }
+
+        output_layer_pbf.add_message(Layer_Encoding::NAME, name);
+
+        for (const auto &key : keys) {
+            output_layer_pbf.add_message(Layer_Encoding::KEYS, key.first, key.second);
+        }
+        if (layer_filter_ == nullptr) {
+            for (const auto &value : values) {
+                output_layer_pbf.add_message(Layer_Encoding::VALUES, value.first, value.second);
+            }
+        } else {
+            // Only values of written features are kept
+            for (std::uint32_t value_index : target.values_order) {
+                const auto& value = values[value_index];
+                output_layer_pbf.add_message(Layer_Encoding::VALUES, value.first, value.second);
+            }
+        }
+        output_layer_pbf.add_uint32(Layer_Encoding::EXTENT, static_cast<uint>(target_extent_));
+        output_layer_pbf.add_uint32(Layer_Encoding::VERSION, version);
+        target.layer_pbf.reset();
     }
-    output_layer_pbf.add_uint32(Layer_Encoding::EXTENT, static_cast<uint>(target_extent_));
-    output_layer_pbf.add_uint32(Layer_Encoding::VERSION, version);
 }
 
-bool Subtiler::ProcessFeature(protozero::pbf_reader *feature_pbf,
-                              std::unordered_map<mapnik::value, std::size_t>* layer_new_tags,
-                              protozero::pbf_writer *output_layer_pbf)
+bool Subtiler::ParseFeature(protozero::pbf_reader *feature_pbf, ParsedFeature* feature)
 {
     using Feature_Encoding = mapnik::vector_tile_impl::Feature_Encoding;
-    uint64_t id = 0;
-    int geom_type = 0;
-    std::vector<packed_uint_32_t> tags, geometrys;
-    std::unique_ptr<FeatureTags> decoded_tags;
-    protozero::pbf_writer output_feature_pbf(*output_layer_pbf, mapnik::vector_tile_impl::Layer_Encoding::FEATURES);
     while (feature_pbf->next()) {
         switch (feature_pbf->tag()) {
             case Feature_Encoding::ID:
-                id = feature_pbf->get_uint64();
+                feature->id = feature_pbf->get_uint64();
                 break;
             case Feature_Encoding::GEOMETRY:
-                geometrys.push_back(std::move(feature_pbf->get_packed_uint32()));
+                feature->geometries.push_back(std::move(feature_pbf->get_packed_uint32()));
                 break;
             case Feature_Encoding::RASTER:
                 LOG(WARNING) << "Raster clipping not implemented yet!";
-                output_feature_pbf.rollback();
                 return false;
             case Feature_Encoding::TAGS:
+                feature->tags.push_back(std::move(feature_pbf->get_packed_uint32()));
                 if (layer_filter_ == nullptr) {
                     // If no filter_table provided, we don't need to decode features
-                    tags.push_back(std::move(feature_pbf->get_packed_uint32()));
+                    break;
+                }
+                if (layer_compiled_filter_ != nullptr) {
+                    if (!layer_compiled_filter_->Evaluate(feature->tags.back())) {
+                        return false;
+                    }
                 } else {
                     // Decode features and apply filters
-                    decoded_tags = DecodeFeatureTags(feature_pbf->get_packed_uint32());
-                    mapnik::value_type result = mapnik::util::apply_visitor(mapnik::evaluate<FeatureTags, mapnik::value, vars_t>(*decoded_tags, vars_), *layer_filter_);
+                    if (!DecodeFeatureTags(feature->tags.back(), &feature_tags_)) {
+                        return false;
+                    }
+                    mapnik::value_type result = mapnik::util::apply_visitor(mapnik::evaluate<FeatureTags, mapnik::value, vars_t>(feature_tags_, vars_), *layer_filter_);
                     if (!result.to_bool()) {
-                        output_feature_pbf.rollback();
                         return false;
                     }
                 }
                 break;
             case Feature_Encoding::TYPE:
-                geom_type = feature_pbf->get_enum();
+                feature->geom_type = feature_pbf->get_enum();
                 break;
             default:
                 LOG(ERROR) << "Vector Tile contains unknown field type " + std::to_string(feature_pbf->tag()) +" in feature";
-                output_feature_pbf.rollback();
                 return false;
         }
     }
 
+    return !feature->geometries.empty();
+}
+
+bool Subtiler::WriteFeature(const ParsedFeature& feature, Target* target)
+{
+    using Feature_Encoding = mapnik::vector_tile_impl::Feature_Encoding;
+    protozero::pbf_writer output_feature_pbf(*target->layer_pbf, mapnik::vector_tile_impl::Layer_Encoding::FEATURES);
+
     bool geometries_written = false;
-    for (auto &geometry : geometrys) {
-        if (ProcessGeometry(geometry, geom_type, &output_feature_pbf)) {
+    for (auto &geometry : feature.geometries) {
+        if (ProcessGeometry(geometry, feature.geom_type, &output_feature_pbf)) {
             geometries_written = true;
         }
     }
@@ -284,64 +390,64 @@ bool Subtiler::ProcessFeature(protozero::pbf_reader *feature_pbf,
     }
 
 
-    output_feature_pbf.add_uint64(Feature_Encoding::ID, id);
-    output_feature_pbf.add_enum(Feature_Encoding::TYPE, geom_type);
+    output_feature_pbf.add_uint64(Feature_Encoding::ID, feature.id);
+    output_feature_pbf.add_enum(Feature_Encoding::TYPE, feature.geom_type);
     if (layer_filter_ == nullptr) {
-        for (auto &tag : tags) {
+        for (auto &tag : feature.tags) {
             output_feature_pbf.add_packed_uint32(Feature_Encoding::TAGS, tag.first, tag.second);
         }
-    } else if (decoded_tags != nullptr){
-        WriteFeatureTags(*decoded_tags, layer_new_tags, &output_feature_pbf);
+    } else if (!feature.tags.empty()) {
+        WriteFeatureTags(feature.tags, target, &output_feature_pbf);
     }
     return true;
 }
 
-std::unique_ptr<FeatureTags> Subtiler::DecodeFeatureTags(const Subtiler::packed_uint_32_t &packed_tags) {
-    auto feature_tags = util::make_unique<FeatureTags>();
+bool Subtiler::DecodeFeatureTags(const Subtiler::packed_uint_32_t &packed_tags, FeatureTags* feature_tags) const {
+    feature_tags->Reset(layer_keys_, layer_mapnik_values_);
     for (auto _i = packed_tags.begin(); _i != packed_tags.end();)
     {
         std::size_t key_index = *(_i++);
         if (_i == packed_tags.end())
         {
             LOG(ERROR) << "Vector Tile has a feature with an odd number of tags, therefore the tile is invalid.";
-            return nullptr;
+            return false;
         }
         std::size_t key_value = *(_i++);
         if (key_index < num_keys_
             && key_value < num_values_)
         {
-            std::string const& key_name = layer_keys_.at(key_index);
-            const mapnik::vector_tile_impl::pbf_attr_value_type& val = layer_values_.at(key_value);
-            feature_tags->push(key_name, key_index, val, transcoder_);
+            feature_tags->push(key_index, key_value);
         } else {
             LOG(ERROR) << "Vector Tile has a feature with repeated attributes with an invalid key or value as it does not appear in the layer.";
         }
     }
-    return feature_tags;
+    return true;
 }
 
-void Subtiler::WriteFeatureTags(const FeatureTags &feature_tags,
-                                std::unordered_map<mapnik::value, std::size_t> *layer_new_tags,
+void Subtiler::WriteFeatureTags(const std::vector<packed_uint_32_t>& tags, Target* target,
                                 protozero::pbf_writer *output_feature_pbf) {
-    std::vector<std::uint32_t> encoded_feature_tags;
-    encoded_feature_tags.reserve(feature_tags.tags_map().size());
-    for (const auto tag_itr : feature_tags.tags_map()) {
-        const tag_type& tag = tag_itr.second;
-        if (tag.second.is_null()) {
-            continue;
-        }
-        encoded_feature_tags.push_back(static_cast<uint32_t>(tag.first)); // push key index
-        const auto val_itr = layer_new_tags->find(tag.second);
-        if (val_itr == layer_new_tags->end()) {
-            std::size_t index = layer_new_tags->size();
-            layer_new_tags->emplace(tag.second, index);
-            encoded_feature_tags.push_back(static_cast<uint32_t>(index)); // add value and push it's index
-        } else {
-            encoded_feature_tags.push_back(static_cast<uint32_t>(val_itr->second)); // push value index
+    encoded_tags_.clear();
+    for (const auto& packed_tags : tags) {
+        for (auto _i = packed_tags.begin(); _i != packed_tags.end();) {
+            std::uint32_t key_index = *(_i++);
+            if (_i == packed_tags.end()) {
+                break;
+            }
+            std::uint32_t value_index = *(_i++);
+            if (key_index >= num_keys_ || value_index >= target->value_ids.size()) {
+                continue;
+            }
+            std::int32_t& new_index = target->value_ids[value_index];
+            if (new_index < 0) {
+                new_index = static_cast<std::int32_t>(target->values_order.size());
+                target->values_order.push_back(value_index);
+            }
+            encoded_tags_.push_back(key_index); // push key index
+            encoded_tags_.push_back(static_cast<std::uint32_t>(new_index)); // push value index
         }
     }
     output_feature_pbf->add_packed_uint32(mapnik::vector_tile_impl::Feature_Encoding::TAGS,
-                                          encoded_feature_tags.begin(), encoded_feature_tags.end());
+                                          encoded_tags_.begin(), encoded_tags_.end());
 }
 
 bool Subtiler::ProcessGeometry(const Subtiler::packed_uint_32_t &packed_geometry,
@@ -445,6 +551,7 @@ bool Subtiler::ProcessLinestring(const Subtiler::packed_uint_32_t &packed_linest
     return WriteLinestring(results, output_geometry);
 }
 
+// Rings of polygons should be already cleaned by ClipPolygon
 inline bool ClipMultiPolygon (mapnik::geometry::multi_polygon<std::int64_t>& mp,
                               std::vector<std::unique_ptr<ClipperLib::PolyTree>>& output_polygons,
                               const mapnik::geometry::linear_ring<std::int64_t>& clip_polygon) {
@@ -452,7 +559,6 @@ inline bool ClipMultiPolygon (mapnik::geometry::multi_polygon<std::int64_t>& mp,
     clipper.StrictlySimple(true);
 
     for (auto& poly : mp) {
-        ClipperLib::CleanPolygon(poly.exterior_ring, 1.415);
         double outer_area = ClipperLib::Area(poly.exterior_ring);
         if (std::abs(outer_area) < 0.1)
         {
@@ -472,7 +578,6 @@ inline bool ClipMultiPolygon (mapnik::geometry::multi_polygon<std::int64_t>& mp,
             {
                 continue;
             }
-            ClipperLib::CleanPolygon(interior_ring, 1.415);
             double inner_area = ClipperLib::Area(interior_ring);
             if (std::abs(inner_area) < 0.1)
             {
@@ -497,6 +602,61 @@ inline bool ClipMultiPolygon (mapnik::geometry::multi_polygon<std::int64_t>& mp,
     return true;
 }
 
+// Returns false if nothing is left of ring after clipping
+static bool ClipRing(mapnik::geometry::linear_ring<std::int64_t>& ring, const mapnik::box2d<std::int64_t>& clip_box,
+                     bool inside, bool exterior, mapnik::geometry::linear_ring<std::int64_t>* output) {
+    if (inside) {
+        output->swap(ring);
+    } else {
+        bbox_clipper::ClipRing(ring, clip_box, output);
+    }
+    const double area = ClipperLib::Area(*output);
+    if (std::abs(area) < 0.1) {
+        output->clear();
+        return false;
+    }
+    // Exterior rings have positive area and interior rings negative one, as in Clipper output
+    if ((area < 0) == exterior) {
+        std::reverse(output->begin(), output->end());
+    }
+    return true;
+}
+
+// Clips polygon by box without Clipper: polygons inside of box are kept as is, simple rings are
+// clipped by bbox_clipper. Returns false if polygon has self-intersecting rings and should be clipped
+// by Clipper. Exterior ring of output is empty if nothing is left of polygon.
+static bool ClipPolygon(mapnik::geometry::polygon<std::int64_t>& polygon, const mapnik::box2d<std::int64_t>& clip_box,
+                        bool inside, mapnik::geometry::polygon<std::int64_t>* output) {
+    ClipperLib::CleanPolygon(polygon.exterior_ring, 1.415);
+    for (auto& interior_ring : polygon.interior_rings) {
+        ClipperLib::CleanPolygon(interior_ring, 1.415);
+    }
+    if (!inside) {
+        if (!bbox_clipper::IsSimpleRing(polygon.exterior_ring)) {
+            return false;
+        }
+        for (const auto& interior_ring : polygon.interior_rings) {
+            if (interior_ring.size() > 2 && !bbox_clipper::IsSimpleRing(interior_ring)) {
+                return false;
+            }
+        }
+    }
+    output->interior_rings.clear();
+    if (!ClipRing(polygon.exterior_ring, clip_box, inside, true, &output->exterior_ring)) {
+        return true;
+    }
+    for (auto& interior_ring : polygon.interior_rings) {
+        if (interior_ring.size() < 3) {
+            continue;
+        }
+        mapnik::geometry::linear_ring<std::int64_t> clipped_ring;
+        if (ClipRing(interior_ring, clip_box, inside, false, &clipped_ring)) {
+            output->add_hole(std::move(clipped_ring));
+        }
+    }
+    return true;
+}
+
 bool Subtiler::ProcessPolygon(const packed_uint_32_t &packed_polygon, protozero::packed_field_uint32 *output_geometry) {
     using GeometryPBF = mapnik::vector_tile_impl::GeometryPBF;
     GeometryPBF::command cmd;
@@ -531,6 +691,8 @@ bool Subtiler::ProcessPolygon(const packed_uint_32_t &packed_polygon, protozero:
 
     mapnik::geometry::multi_polygon<std::int64_t> decoded_mp;
     mapnik::geometry::polygon<std::int64_t>* decoded_polygon;
+    // Polygons which rings are all inside of clip box are not clipped
+    std::vector<bool> polygons_inside;
 
     while (has_next_geometry) {
         double ring_area = 0.0;
@@ -625,21 +787,42 @@ bool Subtiler::ProcessPolygon(const packed_uint_32_t &packed_polygon, protozero:
                 decoded_mp.emplace_back();
                 decoded_polygon = &decoded_mp.back();
                 decoded_polygon->set_exterior_ring(std::move(decoded_ring));
+                polygons_inside.push_back(clip_box_.contains(part_env));
                 looking_for_exterior = false;
             } else {
                 decoded_polygon->add_hole(std::move(decoded_ring));
+                if (!clip_box_.contains(part_env)) {
+                    polygons_inside.back() = false;
+                }
             }
         } else if (current_is_exterior) {
             looking_for_exterior = true;
         }
     }
 
-    std::vector<std::unique_ptr<ClipperLib::PolyTree>> output_polygons;
-    if (!ClipMultiPolygon(decoded_mp, output_polygons, clip_polygon_)) {
-        return false;
+    int64_t start_x = 0, start_y = 0;
+
+    // Clip shape is a box, so Clipper is used only for self-intersecting rings crossing it
+    mapnik::geometry::multi_polygon<std::int64_t> clipper_mp;
+    mapnik::geometry::polygon<std::int64_t> clipped_polygon;
+    for (std::size_t polygon_i = 0; polygon_i < decoded_mp.size(); ++polygon_i) {
+        if (!ClipPolygon(decoded_mp[polygon_i], clip_box_, polygons_inside[polygon_i], &clipped_polygon)) {
+            clipper_mp.push_back(std::move(decoded_mp[polygon_i]));
+            continue;
+        }
+        if (!clipped_polygon.exterior_ring.empty() &&
+                WriteRing(clipped_polygon.exterior_ring, start_x, start_y, output_geometry)) {
+            geometry_written = true;
+            for (auto &interior_ring : clipped_polygon.interior_rings) {
+                WriteRing(interior_ring, start_x, start_y, output_geometry);
+            }
+        }
     }
 
-    int64_t start_x = 0, start_y = 0;
+    std::vector<std::unique_ptr<ClipperLib::PolyTree>> output_polygons;
+    if (!ClipMultiPolygon(clipper_mp, output_polygons, clip_polygon_)) {
+        return geometry_written;
+    }
 
     for (auto &polygons : output_polygons) {
 
@@ -5,6 +5,8 @@
 #include <chrono>
 #include <set>
 #include <map>
+#include <memory>
+#include <unordered_map>
 
 #include <protozero/pbf_reader.hpp>
 #include <protozero/pbf_writer.hpp>
@@ -17,159 +19,154 @@
 #include <vector_tile_datasource_pbf.hpp>
 #include <vector_tile_geometry_decoder.hpp>
 
+#include "feature_index.h"
 #include "filter_table.h"
 #include "tile.h"
 
 
-using tag_type = std::pair<std::size_t, mapnik::value>;
-
-struct push_tag_visitor
+struct to_mapnik_value_visitor
 {
     const mapnik::transcoder & tr_;
-    std::map<std::string, tag_type>& tags_;
-    std::string const& name_;
-    std::size_t key_index_;
-
-    explicit push_tag_visitor(const mapnik::transcoder & tr,
-                    std::map<std::string, tag_type>& tags,
-                    std::string const& name, std::size_t key_index)
-            : tr_(tr),
-              tags_(tags),
-              name_(name),
-              key_index_(key_index) {}
-
-    void operator() (std::string const& val)
+
+    mapnik::value operator() (std::string const& val) const
     {
-        tags_.emplace(name_, tag_type(key_index_, tr_.transcode(val.data(), val.length())));
+        return tr_.transcode(val.data(), val.length());
     }
 
-    void operator() (bool const& val)
+    mapnik::value operator() (bool const& val) const
     {
-        tags_.emplace(name_, tag_type(key_index_, static_cast<mapnik::value_bool>(val)));
+        return static_cast<mapnik::value_bool>(val);
     }
 
-    void operator() (int64_t const& val)
+    mapnik::value operator() (int64_t const& val) const
     {
-        tags_.emplace(name_, tag_type(key_index_, static_cast<mapnik::value_integer>(val)));
+        return static_cast<mapnik::value_integer>(val);
     }
 
-    void operator() (uint64_t const& val)
+    mapnik::value operator() (uint64_t const& val) const
     {
-        tags_.emplace(name_, tag_type(key_index_, static_cast<mapnik::value_integer>(val)));
+        return static_cast<mapnik::value_integer>(val);
     }
 
-    void operator() (double const& val)
+    mapnik::value operator() (double const& val) const
     {
-        tags_.emplace(name_, tag_type(key_index_, static_cast<mapnik::value_double>(val)));
+        return static_cast<mapnik::value_double>(val);
     }
 
-    void operator() (float const& val)
+    mapnik::value operator() (float const& val) const
     {
-        tags_.emplace(name_, tag_type(key_index_, static_cast<mapnik::value_double>(val)));
+        return static_cast<mapnik::value_double>(val);
     }
 };
 
 
 static const mapnik::value default_feature_value{};
 
+// Tags of feature as indices of layer keys and values. Buffer is reused by features of layer, and
+// tags are looked up by name only by filters which can not be compiled.
 class FeatureTags {
 public:
-    inline void push(const std::string& key, std::size_t key_index,
-                     const mapnik::vector_tile_impl::pbf_attr_value_type& value,
-                     const mapnik::transcoder& transcoder) {
-        push_tag_visitor ptv(transcoder, tags_, key, key_index);
-        mapnik::util::apply_visitor(ptv, value);
+    // Dictionaries should outlive tags
+    inline void Reset(const std::vector<std::string>& keys, const std::vector<mapnik::value>& values) noexcept {
+        keys_ = &keys;
+        values_ = &values;
+        tags_.clear();
+    }
+
+    inline void push(std::uint32_t key_index, std::uint32_t value_index) {
+        tags_.emplace_back(key_index, value_index);
     }
 
+    // The first value of repeated key is returned
     inline const mapnik::value& get(const std::string& key) const {
-        auto tag_itr = tags_.find(key);
-        if (tag_itr == tags_.end()) {
-            return default_feature_value;
+        for (const auto& tag : tags_) {
+            if ((*keys_)[tag.first] == key) {
+                return (*values_)[tag.second];
+            }
         }
-        return tag_itr->second.second;
+        return default_feature_value;
     }
 
     inline const mapnik::geometry::geometry<double> get_geometry() const noexcept {
         return mapnik::geometry::geometry_empty{};
     }
 
-    inline const std::map<std::string, tag_type>& tags_map() const noexcept {
-        return tags_;
-    };
-
 private:
-    std::map<std::string, tag_type> tags_;
-};
-
-
-struct to_tile_value_pbf
-{
-public:
-    using Value_Encoding = mapnik::vector_tile_impl::Value_Encoding;
-
-    explicit to_tile_value_pbf(protozero::pbf_writer & value):
-            value_(value) {}
-
-    void operator () ( mapnik::value_integer val ) const
-    {
-        value_.add_int64(Value_Encoding::INT,val);
-    }
-
-    void operator () ( mapnik::value_bool val ) const
-    {
-        value_.add_bool(Value_Encoding::BOOL,val);
-    }
-
-    void operator () ( mapnik::value_double val ) const
-    {
-        float fval = static_cast<float>(val);
-        if (val == static_cast<double>(fval))
-        {
-            value_.add_float(Value_Encoding::FLOAT, fval);
-        }
-        else
-        {
-            value_.add_double(Value_Encoding::DOUBLE, val);
-        }
-    }
-
-    void operator () ( mapnik::value_unicode_string const& val ) const
-    {
-        std::string str;
-        mapnik::to_utf8(val, str);
-        value_.add_string(Value_Encoding::STRING, str);
-    }
-
-    void operator () ( mapnik::value_null const& /*val*/ ) const
-    {
-        // do nothing
-    }
-private:
-    protozero::pbf_writer & value_;
+    const std::vector<std::string>* keys_{nullptr};
+    const std::vector<mapnik::value>* values_{nullptr};
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> tags_;
 };
 
 
 class Subtiler {
 public:
-    Subtiler(const Tile& base_tile, std::shared_ptr<const FilterTable> filter_table = nullptr);
-    Subtiler(Tile&& base_tile, std::shared_ptr<const FilterTable> filter_table = nullptr);
+    // Feature index of base tile is built on first use if not provided
+    Subtiler(const Tile& base_tile, std::shared_ptr<const FilterTable> filter_table = nullptr,
+             std::shared_ptr<const TileFeatureIndex> feature_index = nullptr);
+    Subtiler(Tile&& base_tile, std::shared_ptr<const FilterTable> filter_table = nullptr,
+             std::shared_ptr<const TileFeatureIndex> feature_index = nullptr);
 
     std::string MakeSubtile(const TileId& target_tile_id,
                             uint target_extent = 4096, int buffer_size = 16,
                             std::unique_ptr<std::set<std::string>> layers = nullptr);
 
+    // Makes subtiles of the same zoom in one pass over base tile. Every feature is parsed and filtered once
+    // and written to subtiles intersecting its bounding box. Results are in order of target tiles, empty
+    // vector is returned on error.
+    std::vector<std::string> MakeSubtiles(const std::vector<TileId>& target_tile_ids,
+                                          uint target_extent = 4096, int buffer_size = 16,
+                                          std::unique_ptr<std::set<std::string>> layers = nullptr);
+
+    // Index of base tile, nullptr before first subtile is made if not provided
+    inline const std::shared_ptr<const TileFeatureIndex>& feature_index() const noexcept {
+        return feature_index_;
+    }
 
 private:
     using packed_uint_32_t = protozero::iterator_range<protozero::pbf_reader::const_uint32_iterator>;
     using point_t = std::pair<int64_t, int64_t>;
     using line_t = std::vector<point_t>;
 
-    void UpdateTargetParams(uint target_x, uint target_y, uint source_extent, uint target_extent);
-    void ProcessLayer(protozero::pbf_reader* layer_pbf, protozero::pbf_writer* output_pbf);
-    bool ProcessFeature(protozero::pbf_reader* feature_pbf,
-                        std::unordered_map<mapnik::value, std::size_t>* layer_new_tags,
-                        protozero::pbf_writer *output_layer_pbf);
-    std::unique_ptr<FeatureTags> DecodeFeatureTags(const packed_uint_32_t& packed_tags);
+    // Subtile being made, transform parameters are of the layer processed now
+    struct Target {
+        TileId tile_id;
+        std::string data;
+        std::unique_ptr<protozero::pbf_writer> tile_pbf;
+        std::unique_ptr<protozero::pbf_writer> layer_pbf;
+        // Values of layer written to subtile are interned by their source index: index in subtile
+        // by source index (-1 if not written yet) and source indices in order of subtile
+        std::vector<std::int32_t> value_ids;
+        std::vector<std::uint32_t> values_order;
+        // Buffered subtile area in layer coordinates
+        mapnik::box2d<int64_t> source_bbox;
+        double scale;
+        int offset_x;
+        int offset_y;
+        bool features_written;
+    };
+
+    // Feature fields shared by all targets. It is reused by features of layer, so vectors keep capacity.
+    struct ParsedFeature {
+        inline void Clear() noexcept {
+            id = 0;
+            geom_type = 0;
+            tags.clear();
+            geometries.clear();
+        }
+
+        uint64_t id{0};
+        int geom_type{0};
+        std::vector<packed_uint_32_t> tags;
+        std::vector<packed_uint_32_t> geometries;
+    };
+
+    void UpdateTargetParams(Target* target, uint source_extent) const;
+    void SetTarget(const Target& target) noexcept;
+    void ProcessLayer(protozero::pbf_reader* layer_pbf, const TileFeatureIndex::Layer* layer_index,
+                      std::vector<Target>* targets);
+    bool ParseFeature(protozero::pbf_reader* feature_pbf, ParsedFeature* feature);
+    bool WriteFeature(const ParsedFeature& feature, Target* target);
+    bool DecodeFeatureTags(const packed_uint_32_t& packed_tags, FeatureTags* feature_tags) const;
     bool ProcessGeometry(const packed_uint_32_t& packed_geometry, int geom_type, protozero::pbf_writer *output_feature_pbf);
     bool ProcessPoint(const packed_uint_32_t& packed_point, protozero::packed_field_uint32* output_geometry);
     bool ProcessLinestring(const packed_uint_32_t& packed_linestring, protozero::packed_field_uint32* output_geometry);
@@ -179,8 +176,7 @@ private:
     inline bool WriteLinestring(const mapnik::geometry::multi_line_string<int64_t>& multi_line, protozero::packed_field_uint32* output_geometry);
     inline bool WriteRing(const mapnik::geometry::linear_ring<std::int64_t> &linear_ring,
                           int64_t &start_x, int64_t &start_y, protozero::packed_field_uint32 *output_geometry);
-    void WriteFeatureTags(const FeatureTags& feature_tags,
-                          std::unordered_map<mapnik::value, std::size_t>* layer_new_tags,
+    void WriteFeatureTags(const std::vector<packed_uint_32_t>& tags, Target* target,
                           protozero::pbf_writer *output_feature_pbf);
 
     inline void ScaleAndOffset(int64_t *x, int64_t *y) const {
@@ -234,7 +230,17 @@ private:
     int zoom_factor_;
 
     std::shared_ptr<const FilterTable> filter_table_;
+    std::shared_ptr<const TileFeatureIndex> feature_index_;
     mapnik::expression_ptr layer_filter_;
+    std::shared_ptr<const CompiledFilter> compiled_filter_;
+    // Compiled filter bound to current layer, nullptr if layer filter is evaluated by mapnik
+    std::unique_ptr<CompiledFilter::LayerFilter> layer_compiled_filter_;
+    // Values of current layer dictionary, decoded only for filtered layers
+    std::vector<mapnik::value> layer_mapnik_values_;
+    // Tags of current feature for filters evaluated by mapnik
+    FeatureTags feature_tags_;
+    // Encoded tags of current feature
+    std::vector<std::uint32_t> encoded_tags_;
     std::vector<std::string> layer_keys_;
     mapnik::vector_tile_impl::layer_pbf_attr_type layer_values_;
     size_t num_keys_;
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <mapnik/image.hpp>
+#include <mapnik/grid/grid.hpp>
+
+
+inline void ClearSurface(mapnik::image_rgba8& image) {
+    image.set(0);
+}
+
+inline void ClearSurface(mapnik::grid& grid) {
+    grid.clear();
+}
+
+inline std::size_t SurfaceBytes(const mapnik::image_rgba8& image) {
+    return image.size();
+}
+
+inline std::size_t SurfaceBytes(const mapnik::grid& grid) {
+    return grid.width() * grid.height() * sizeof(mapnik::grid::value_type);
+}
+
+
+// Pool of render surfaces (images or grids) reused between renders. Surface is returned to the pool
+// (cleared) when its pointer is destroyed, this can happen in any thread, even after the pool is destroyed.
+// Pool holds limited number and bytes of free surfaces, larger surfaces are freed instead of being kept.
+template <typename Surface>
+class SurfacePool {
+    struct State {
+        std::mutex mux;
+        std::vector<std::unique_ptr<Surface>> free_surfaces;
+        std::size_t capacity;
+        std::size_t max_bytes;
+        // Bytes of free surfaces
+        std::size_t bytes{0};
+    };
+
+public:
+    class Deleter {
+    public:
+        Deleter() = default;
+        Deleter(std::weak_ptr<State> state) : state_(std::move(state)) {}
+
+        void operator()(Surface* surface) const {
+            std::unique_ptr<Surface> surface_ptr(surface);
+            auto state = state_.lock();
+            const std::size_t bytes = SurfaceBytes(*surface_ptr);
+            if (!state || bytes > state->max_bytes) {
+                return;
+            }
+            ClearSurface(*surface_ptr);
+            std::lock_guard<std::mutex> lock(state->mux);
+            auto& free_surfaces = state->free_surfaces;
+            // Drop the oldest surfaces, the most recent size is likely to be requested again
+            while (!free_surfaces.empty() && (free_surfaces.size() >= state->capacity ||
+                                              state->bytes + bytes > state->max_bytes)) {
+                state->bytes -= SurfaceBytes(*free_surfaces.front());
+                free_surfaces.erase(free_surfaces.begin());
+            }
+            state->bytes += bytes;
+            free_surfaces.push_back(std::move(surface_ptr));
+        }
+
+    private:
+        std::weak_ptr<State> state_;
+    };
+
+    using surface_ptr = std::unique_ptr<Surface, Deleter>;
+
+    // Default byte limit keeps one 8x8 or retina 4x4 metatile image
+    SurfacePool(std::size_t capacity = 2, std::size_t max_bytes = 16 << 20) : state_(std::make_shared<State>()) {
+        state_->capacity = capacity;
+        state_->max_bytes = max_bytes;
+    }
+
+    // Returns cleared surface of given size. Extra args are passed to constructor of new surface.
+    template <typename ...Args>
+    surface_ptr Acquire(std::size_t width, std::size_t height, Args&&... args) {
+        {
+            std::lock_guard<std::mutex> lock(state_->mux);
+            auto& free_surfaces = state_->free_surfaces;
+            for (auto surface_itr = free_surfaces.rbegin(); surface_itr != free_surfaces.rend(); ++surface_itr) {
+                Surface& surface = **surface_itr;
+                if (surface.width() == width && surface.height() == height) {
+                    state_->bytes -= SurfaceBytes(surface);
+                    Surface* reused_surface = surface_itr->release();
+                    free_surfaces.erase(std::next(surface_itr).base());
+                    return surface_ptr(reused_surface, Deleter(state_));
+                }
+            }
+        }
+        return surface_ptr(new Surface(width, height, std::forward<Args>(args)...), Deleter(state_));
+    }
+
+private:
+    std::shared_ptr<State> state_;
+};
@@ -0,0 +1,201 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+
+// Plain FIFO queue used by ThreadPool by default.
+template <typename Task>
+class FifoTaskQueue {
+public:
+    using token_t = std::nullptr_t;
+
+    static constexpr bool kTracksCompletion = false;
+
+    inline bool empty() const noexcept {
+        return tasks_.empty();
+    }
+
+    inline std::size_t size() const noexcept {
+        return tasks_.size();
+    }
+
+    template <typename T>
+    inline void push(T&& task) {
+        tasks_.push_back(std::forward<T>(task));
+    }
+
+    inline Task pop(token_t& /*token*/) {
+        Task task = std::move(tasks_.front());
+        tasks_.pop_front();
+        return task;
+    }
+
+    // Drops the oldest task when queue limit is reached.
+    inline void drop() {
+        tasks_.pop_front();
+    }
+
+    inline void complete(const token_t& /*token*/, std::chrono::microseconds /*duration*/) noexcept {}
+
+private:
+    std::deque<Task> tasks_;
+};
+
+
+// Deficit round-robin queue. Tasks are split into sub-queues by Task::queue_key and each
+// sub-queue gets a share of worker time proportional to its weight. Task cost is estimated
+// from measured processing time of previous tasks from the same sub-queue, so one slow
+// sub-queue can not starve cheap ones.
+template <typename Task>
+class FairTaskQueue {
+    struct SubQueue {
+        std::deque<Task> tasks;
+        double deficit{0.0};
+        double cost{1.0};
+        uint weight{1};
+        bool visited{false};
+        bool active{false};
+    };
+
+public:
+    using token_t = SubQueue*;
+    using weights_t = std::unordered_map<std::string, uint>;
+
+    static constexpr bool kTracksCompletion = true;
+
+    inline bool empty() const noexcept {
+        return size_ == 0;
+    }
+
+    inline std::size_t size() const noexcept {
+        return size_;
+    }
+
+    void SetWeights(weights_t weights, uint default_weight = 1) {
+        weights_ = std::move(weights);
+        default_weight_ = default_weight > 0 ? default_weight : 1;
+        for (auto& sq_itr : sub_queues_) {
+            sq_itr.second->weight = GetWeight(sq_itr.first);
+        }
+    }
+
+    template <typename T>
+    void push(T&& task) {
+        SubQueue& sq = GetSubQueue(task.queue_key);
+        sq.tasks.push_back(std::forward<T>(task));
+        ++size_;
+        if (!sq.active) {
+            sq.active = true;
+            active_.push_back(&sq);
+        }
+    }
+
+    Task pop(token_t& token) {
+        assert(size_ > 0);
+        while (true) {
+            SubQueue* sq = active_.front();
+            if (!sq->visited) {
+                sq->visited = true;
+                sq->deficit += sq->weight * quantum_;
+            }
+            if (sq->deficit >= sq->cost) {
+                Task task = std::move(sq->tasks.front());
+                sq->tasks.pop_front();
+                sq->deficit -= sq->cost;
+                --size_;
+                if (sq->tasks.empty()) {
+                    Deactivate(sq);
+                    active_.pop_front();
+                }
+                token = sq;
+                return task;
+            }
+            sq->visited = false;
+            active_.pop_front();
+            active_.push_back(sq);
+        }
+    }
+
+    // Drops the oldest task of the longest sub-queue, so overload of one sub-queue
+    // does not affect the others.
+    void drop() {
+        assert(size_ > 0);
+        SubQueue* longest = nullptr;
+        for (SubQueue* sq : active_) {
+            if (!longest || sq->tasks.size() > longest->tasks.size()) {
+                longest = sq;
+            }
+        }
+        assert(longest);
+        longest->tasks.pop_front();
+        --size_;
+        if (longest->tasks.empty()) {
+            Deactivate(longest);
+            for (auto itr = active_.begin(); itr != active_.end(); ++itr) {
+                if (*itr == longest) {
+                    active_.erase(itr);
+                    break;
+                }
+            }
+        }
+    }
+
+    void complete(const token_t& token, std::chrono::microseconds duration) noexcept {
+        if (!token) {
+            return;
+        }
+        double cost = std::max(1.0, static_cast<double>(duration.count()));
+        token->cost = token->cost * (1.0 - kCostSmoothing) + cost * kCostSmoothing;
+        // Quantum should be not less than the most expensive task, so every sub-queue
+        // can process at least one task per round.
+        double max_cost = 1.0;
+        for (const auto& sq_itr : sub_queues_) {
+            max_cost = std::max(max_cost, sq_itr.second->cost);
+        }
+        quantum_ = max_cost;
+    }
+
+private:
+    static constexpr double kCostSmoothing = 0.2;
+
+    inline uint GetWeight(const std::string& key) const {
+        auto weight_itr = weights_.find(key);
+        if (weight_itr == weights_.end() || weight_itr->second == 0) {
+            return default_weight_;
+        }
+        return weight_itr->second;
+    }
+
+    SubQueue& GetSubQueue(const std::string& key) {
+        auto sq_itr = sub_queues_.find(key);
+        if (sq_itr != sub_queues_.end()) {
+            return *sq_itr->second;
+        }
+        auto sq = std::make_unique<SubQueue>();
+        sq->weight = GetWeight(key);
+        sq->cost = quantum_;
+        SubQueue& sq_ref = *sq;
+        sub_queues_.emplace(key, std::move(sq));
+        return sq_ref;
+    }
+
+    static inline void Deactivate(SubQueue* sq) noexcept {
+        sq->active = false;
+        sq->visited = false;
+        sq->deficit = 0.0;
+    }
+
+    // Sub-queues are never removed, so raw pointers stay valid (including tokens of tasks in progress).
+    std::unordered_map<std::string, std::unique_ptr<SubQueue>> sub_queues_;
+    std::deque<SubQueue*> active_;
+    weights_t weights_;
+    double quantum_{1.0};
+    std::size_t size_{0};
+    uint default_weight_{1};
+};
@@ -1,16 +1,18 @@
 #pragma once
 
+#include <chrono>
 #include <condition_variable>
-#include <deque>
 #include <list>
 #include <mutex>
 #include <thread>
+#include <vector>
 
 #include "async_task.h"
+#include "task_queue.h"
 #include "worker.h"
 
 
-template <typename Wrk, typename Task>
+template <typename Wrk, typename Task, typename Queue = FifoTaskQueue<Task>>
 class ThreadPool {
     static_assert(std::is_base_of<Worker<Task>, Wrk>::value, "Actual worker have to subclass Worker class!");
     static_assert(std::is_nothrow_move_constructible<Task>::value &&
@@ -22,6 +24,7 @@ public:
     using worker_t = Wrk;
     using worker_fn_t = std::function<void(worker_t&)>;
     using task_t = Task;
+    using queue_t = Queue;
 
     using WorkerInitTask = AsyncTask<worker_t*, worker_t*>;
     using success_init_cb_t = typename WorkerInitTask::result_cb_t;
@@ -42,7 +45,7 @@ private:
 
     class WorkerHelper {
     public:
-        WorkerHelper(std::unique_ptr<Wrk>&& wrk, std::shared_ptr<WorkerInitTask> init_task, std::deque<Task>& tasks,
+        WorkerHelper(std::unique_ptr<Wrk>&& wrk, std::shared_ptr<WorkerInitTask> init_task, Queue& tasks,
                      std::mutex& mux, std::condition_variable& cv) :
                 init_task_(std::move(init_task)),
                 worker_(std::move(wrk)),
@@ -66,6 +69,7 @@ private:
 
             Task task;
             worker_fn_t fn;
+            typename Queue::token_t token{};
             bool process_task;
             while (!stop_flag_) {
                 {
@@ -81,13 +85,21 @@ private:
                         functions_.pop_front();
                         process_task = false;
                     } else {
-                        task = std::move(tasks_.front());
-                        tasks_.pop_front();
+                        task = tasks_.pop(token);
                         process_task = true;
                     }
                 }
                 if (process_task) {
-                    worker_->ProcessTask(std::move(task));
+                    if (Queue::kTracksCompletion) {
+                        auto start_time = std::chrono::steady_clock::now();
+                        worker_->ProcessTask(std::move(task));
+                        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+                                    std::chrono::steady_clock::now() - start_time);
+                        std::lock_guard<std::mutex> lock(mux_);
+                        tasks_.complete(token, duration);
+                    } else {
+                        worker_->ProcessTask(std::move(task));
+                    }
                 } else {
                     fn(*worker_);
                 }
@@ -110,7 +122,7 @@ private:
         std::deque<worker_fn_t> functions_;
         std::shared_ptr<WorkerInitTask> init_task_;
         std::unique_ptr<Wrk> worker_;
-        std::deque<Task>& tasks_;
+        Queue& tasks_;
         std::mutex& mux_;
         std::condition_variable& cv_;
         std::atomic_bool stop_flag_{false};
@@ -146,11 +158,23 @@ public:
         return workers;
     }
 
+    inline std::size_t QueueSize() const {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        return tasks_.size();
+    }
+
     inline void SetQueueLimit(std::size_t queue_limit) {
         std::lock_guard<std::mutex> lock(queue_mutex_);
         queue_limit_ = queue_limit;
     }
 
+    // Provides synchronized access to the underlying queue (e.g. for setting queue weights).
+    template <typename Fn>
+    void ModifyQueue(Fn&& fn) {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        fn(tasks_);
+    }
+
     inline void PostTask(const task_t& task) {
         PostTaskImpl(task);
     }
@@ -195,7 +219,7 @@ public:
             if (num_workers >= workers_.size()) {
                 end_iter = workers_.end();
             } else {
-                end_iter = workers_.begin() + (num_workers - 1);
+                end_iter = std::next(workers_.begin(), num_workers);
             }
             wh_to_remove.splice(wh_to_remove.end(), workers_, workers_.begin(), end_iter);
         }
@@ -214,7 +238,7 @@ public:
         {
             std::lock_guard<std::mutex> lock(workers_mutex_);
             for (auto wh_itr = workers_.begin(); wh_itr != workers_.end(); ++wh_itr) {
-                if (wh_itr->worker.get() == wrk_ptr) {
+                if (wh_itr->worker_ptr() == wrk_ptr) {
                     wh_to_remove.splice(wh_to_remove.end(), workers_, wh_itr);
                     found = true;
                     break;
@@ -245,13 +269,13 @@ private:
     void PostTaskImpl(T&& task) {
         std::lock_guard<std::mutex> lock(queue_mutex_);
         if (queue_limit_ && tasks_.size() >= queue_limit_) {
-            tasks_.pop_front();
+            tasks_.drop();
         }
-        tasks_.push_back(std::forward<T>(task));
+        tasks_.push(std::forward<T>(task));
         wake_one();
     }
 
-    std::deque<Task> tasks_;
+    Queue tasks_;
     std::list<WorkerHelper> workers_;
     mutable std::mutex workers_mutex_;
     mutable std::mutex queue_mutex_;
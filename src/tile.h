@@ -1,5 +1,6 @@
 #pragma once
 
+#include <chrono>
 #include <cmath>
 #include <string>
 #include <vector>
@@ -141,5 +142,10 @@ struct Metatile {
     bool Validate() const noexcept;
 
     MetatileId id;
+    // Image (or mvt) tiles
     std::vector<Tile> tiles;
+    // UTFGrid tiles, filled only by renders including utfgrid
+    std::vector<Tile> utfgrid_tiles;
+    // Time spent by workers on producing metatile (without queueing), zero if unknown
+    std::chrono::microseconds render_time{0};
 };
@@ -53,8 +53,8 @@ void TileCacher::Set(const std::string& key, std::shared_ptr<const CachedTile> c
         auto set_waiters_itr = set_waiters_.find(key);
         if (set_waiters_itr != set_waiters_.end()) {
             waiters_vec = std::move(set_waiters_itr->second);
+            set_waiters_.erase(set_waiters_itr);
         }
-        set_waiters_.erase(set_waiters_itr);
     }
     for (auto get_task : waiters_vec) {
         get_task->SetResult(cached_tile);
@@ -69,7 +69,7 @@ void TileCacher::Touch(const std::string& key, std::chrono::seconds expire_time)
 
 std::unique_ptr<CacherLock> TileCacher::LockUntilSet(std::vector<std::string> keys) {
     bool locked = false;
-    std::vector<std::string> locked_keys;
+    std::unordered_set<std::string> locked_keys;
     locked_keys.reserve(keys.size());
     {
         std::lock_guard<std::mutex> lock(mux_);
@@ -77,7 +77,7 @@ std::unique_ptr<CacherLock> TileCacher::LockUntilSet(std::vector<std::string> ke
             if (set_waiters_.find(key) == set_waiters_.end()) {
                 set_waiters_[key] = {};
                 locked = true;
-                locked_keys.push_back(std::move(key));
+                locked_keys.insert(std::move(key));
             }
         }
     }
@@ -87,7 +87,7 @@ std::unique_ptr<CacherLock> TileCacher::LockUntilSet(std::vector<std::string> ke
     return std::make_unique<CacherLock>(*this, std::move(locked_keys));
 }
 
-void TileCacher::Unlock(const std::vector<std::string>& keys) {
+void TileCacher::Unlock(const std::unordered_set<std::string>& keys) {
     for (const std::string& key : keys) {
         waiters_vec_t waiters;
         {
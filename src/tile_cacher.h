@@ -6,6 +6,7 @@
 #include <mutex>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "async_task.h"
@@ -40,7 +41,7 @@ public:
              std::chrono::seconds expire_time, std::shared_ptr<SetTask> task);
     void Touch(const std::string& key, std::chrono::seconds expire_time);
     std::unique_ptr<CacherLock> LockUntilSet(std::vector<std::string> keys);
-    void Unlock(const std::vector<std::string>& keys);
+    void Unlock(const std::unordered_set<std::string>& keys);
 
     void OnTileRetrieved(const std::string& key, std::shared_ptr<CachedTile> cached_tile);
     void OnRetrieveError(const std::string& key);
@@ -67,7 +68,7 @@ private:
 
 class CacherLock {
 public:
-    explicit CacherLock(TileCacher& cacher, std::vector<std::string> keys) :
+    explicit CacherLock(TileCacher& cacher, std::unordered_set<std::string> keys) :
         locked_keys_(std::move(keys)), cacher_(cacher) { }
 
     ~CacherLock() {
@@ -85,8 +86,14 @@ public:
         locked_ = false;
     }
 
+    // Key is set to cache by lock owner, so it is not unlocked by this lock anymore.
+    // Otherwise lock of the same key taken by other handler after set could be removed.
+    inline void Release(const std::string& key) {
+        locked_keys_.erase(key);
+    }
+
 private:
-    std::vector<std::string> locked_keys_;
+    std::unordered_set<std::string> locked_keys_;
     TileCacher& cacher_;
     bool locked_{true};
 };
@@ -0,0 +1,162 @@
+#include "tile_encoder.h"
+
+#include <mapnik/image_util.hpp>
+
+#include <glog/logging.h>
+
+#include "json_util.h"
+
+using json_util::FromJson;
+
+
+// Encodes tiles with mapnik png encoder configured by format string
+class MapnikTileEncoder : public TileEncoder {
+public:
+    MapnikTileEncoder(const EncodingProfile& profile) :
+            TileEncoder(profile),
+            format_str_(MakeFormatString(profile)) {}
+
+    std::string Encode(const mapnik::image_view<mapnik::image_rgba8>& view) const override {
+        return mapnik::save_to_string(view, format_str_);
+    }
+
+    const std::string& key() const noexcept override {
+        return format_str_;
+    }
+
+private:
+    static std::string MakeFormatString(const EncodingProfile& profile) {
+        std::string format_str;
+        if (profile.format == EncodingProfile::Format::webp) {
+            format_str.append("webp:quality=");
+            format_str.append(std::to_string(profile.quality));
+            format_str.append(":method=");
+            format_str.append(std::to_string(profile.method));
+            if (profile.lossless) {
+                format_str.append(":lossless=1");
+            }
+            return format_str;
+        }
+        if (profile.format == EncodingProfile::Format::png8) {
+            format_str.append("png8:c=");
+            format_str.append(std::to_string(profile.colors));
+            if (profile.quantizer == EncodingProfile::Quantizer::hextree) {
+                format_str.append(":m=h");
+            }
+        } else {
+            format_str.append("png32");
+        }
+        format_str.append(":z=");
+        format_str.append(std::to_string(profile.compression_level));
+        switch (profile.strategy) {
+        case EncodingProfile::Strategy::standard:
+            break;
+        case EncodingProfile::Strategy::filtered:
+            format_str.append(":s=filtered");
+            break;
+        case EncodingProfile::Strategy::huffman_only:
+            format_str.append(":s=huff");
+            break;
+        case EncodingProfile::Strategy::rle:
+            format_str.append(":s=rle");
+            break;
+        }
+        if (profile.miniz) {
+            format_str.append(":e=miniz");
+        }
+        return format_str;
+    }
+
+    const std::string format_str_;
+};
+
+
+static bool ParseProfile(const Json::Value& joutput, EncodingProfile& profile) {
+    if (!joutput.isObject()) {
+        LOG(ERROR) << "Output profile should be an object!";
+        return false;
+    }
+    std::string format = FromJson<std::string>(joutput["format"], "png8");
+    if (format == "png8") {
+        profile.format = EncodingProfile::Format::png8;
+    } else if (format == "png32" || format == "png") {
+        profile.format = EncodingProfile::Format::png32;
+    } else if (format == "webp") {
+        profile.format = EncodingProfile::Format::webp;
+        profile.quality = FromJson<uint>(joutput["quality"], 80);
+        profile.method = FromJson<uint>(joutput["method"], 4);
+        profile.lossless = FromJson<bool>(joutput["lossless"], false);
+        if (profile.quality > 100 || profile.method > 6) {
+            LOG(ERROR) << "WebP quality should be in range [0, 100] and method in range [0, 6]!";
+            return false;
+        }
+        return true;
+    } else {
+        LOG(ERROR) << "Unsupported output format: " << format;
+        return false;
+    }
+
+    profile.colors = FromJson<uint>(joutput["colors"], 256);
+    if (profile.colors < 2 || profile.colors > 256) {
+        LOG(ERROR) << "Palette size should be in range [2, 256]!";
+        return false;
+    }
+
+    std::string encoder = FromJson<std::string>(joutput["deflate"], "zlib");
+    if (encoder == "miniz") {
+        profile.miniz = true;
+    } else if (encoder != "zlib") {
+        LOG(ERROR) << "Unsupported deflate implementation: " << encoder;
+        return false;
+    }
+
+    profile.compression_level = FromJson<int>(joutput["compression"], 1);
+    const int max_level = profile.miniz ? 10 : 9;
+    if (profile.compression_level < 0 || profile.compression_level > max_level) {
+        LOG(ERROR) << "Compression level should be in range [0, " << max_level << "]!";
+        return false;
+    }
+
+    std::string strategy = FromJson<std::string>(joutput["strategy"], "default");
+    if (strategy == "default") {
+        profile.strategy = EncodingProfile::Strategy::standard;
+    } else if (strategy == "filtered") {
+        profile.strategy = EncodingProfile::Strategy::filtered;
+    } else if (strategy == "huffman") {
+        profile.strategy = EncodingProfile::Strategy::huffman_only;
+    } else if (strategy == "rle") {
+        profile.strategy = EncodingProfile::Strategy::rle;
+    } else {
+        LOG(ERROR) << "Unsupported compression strategy: " << strategy;
+        return false;
+    }
+
+    std::string quantizer = FromJson<std::string>(joutput["quantizer"], "octree");
+    if (quantizer == "octree") {
+        profile.quantizer = EncodingProfile::Quantizer::octree;
+    } else if (quantizer == "hextree") {
+        profile.quantizer = EncodingProfile::Quantizer::hextree;
+    } else {
+        LOG(ERROR) << "Unsupported quantizer: " << quantizer;
+        return false;
+    }
+    return true;
+}
+
+
+std::shared_ptr<const TileEncoder> TileEncoder::MakeEncoder(const Json::Value& joutput) {
+    EncodingProfile profile;
+    if (!ParseProfile(joutput, profile)) {
+        return nullptr;
+    }
+    return MakeEncoder(profile);
+}
+
+std::shared_ptr<const TileEncoder> TileEncoder::MakeEncoder(const EncodingProfile& profile) {
+    return std::make_shared<MapnikTileEncoder>(profile);
+}
+
+const TileEncoder& TileEncoder::DefaultEncoder() {
+    static const MapnikTileEncoder default_encoder{EncodingProfile()};
+    return default_encoder;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <jsoncpp/json/value.h>
+
+#include <mapnik/image.hpp>
+#include <mapnik/image_view.hpp>
+
+
+// Output profile of rendered raster tiles.
+struct EncodingProfile {
+    enum class Format : std::uint8_t {
+        png8,
+        png32,
+        webp
+    };
+
+    enum class Strategy : std::uint8_t {
+        standard,
+        filtered,
+        huffman_only,
+        rle
+    };
+
+    enum class Quantizer : std::uint8_t {
+        octree,
+        hextree
+    };
+
+    Format format{Format::png8};
+    // Palette size for png8
+    uint colors{256};
+    int compression_level{1};
+    Strategy strategy{Strategy::standard};
+    Quantizer quantizer{Quantizer::octree};
+    // Use miniz deflate instead of zlib
+    bool miniz{false};
+    // WebP quality [0, 100] and compression method [0, 6] (higher is slower and smaller)
+    uint quality{80};
+    uint method{4};
+    bool lossless{false};
+};
+
+
+class TileEncoder {
+public:
+    // Makes encoder from endpoint "output" config. Returns nullptr on invalid config.
+    static std::shared_ptr<const TileEncoder> MakeEncoder(const Json::Value& joutput);
+    static std::shared_ptr<const TileEncoder> MakeEncoder(const EncodingProfile& profile);
+
+    // Encoder used when endpoint has no output profile (png8 with compression level 1)
+    static const TileEncoder& DefaultEncoder();
+
+    virtual ~TileEncoder() {}
+
+    virtual std::string Encode(const mapnik::image_view<mapnik::image_rgba8>& view) const = 0;
+
+    // Mapnik format string of encoder output. Identifies output in cache keys and solid tile references.
+    virtual const std::string& key() const noexcept = 0;
+
+    inline const EncodingProfile& profile() const noexcept {
+        return profile_;
+    }
+
+protected:
+    TileEncoder(const EncodingProfile& profile) : profile_(profile) {}
+
+private:
+    const EncodingProfile profile_;
+};
@@ -1,7 +1,9 @@
 #include "tile_handler.h"
 
-#include <fstream>
+#include <algorithm>
 #include <cctype>
+#include <cstdlib>
+#include <fstream>
 
 #include <folly/io/async/EventBaseManager.h>
 
@@ -11,10 +13,13 @@
 #include <vector_tile_compression.hpp>
 
 #include "data_provider.h"
+#include "metatile_sizer.h"
 #include "nodes_monitor.h"
 #include "rendermanager.h"
 #include "session_wrapper.h"
+#include "solid_tile.h"
 #include "tile_cacher.h"
+#include "tile_encoder.h"
 #include "tile_processing_manager.h"
 #include "util.h"
 
@@ -45,7 +50,7 @@ static std::string MakeCacherKey(const TileId& id, const std::string& info_str)
     return key;
 }
 
-static std::string MakeRequestInfoStr(const TileRequest& request, const std::string& ext_str,
+static std::string MakeRequestInfoStr(const TileRequest& request, util::ExtensionType ext,
                                       uint style_version) {
     std::string info_str;
     for (const std::string& tag : request.tags) {
@@ -53,20 +58,35 @@ static std::string MakeRequestInfoStr(const TileRequest& request, const std::str
         info_str.append("/");
     }
     info_str.append(".");
-    info_str.append(ext_str);
+    info_str.append(util::ext2str(ext));
     info_str.append("/");
     info_str.append(request.endpoint_params->style_name);
     info_str.append("/");
+    const TileEncoder* tile_encoder = nullptr;
+    if (ext == util::ExtensionType::png) {
+        tile_encoder = request.endpoint_params->tile_encoder.get();
+    } else if (ext == util::ExtensionType::webp) {
+        tile_encoder = request.endpoint_params->webp_encoder.get();
+    }
+    if (tile_encoder) {
+        info_str.append(tile_encoder->key());
+        info_str.append("/");
+    }
     info_str.append(request.data_version);
     info_str.append("/");
     if (style_version != 0) {
         info_str.append(std::to_string(style_version));
         info_str.append("/");
     }
-    info_str.append(std::to_string(request.metatile_id.width()));
-    info_str.append("/");
-    info_str.append(std::to_string(request.metatile_id.height()));
-    info_str.append("/");
+    if (request.endpoint_params->metatile_sizer) {
+        // Metatile size changes over time, tiles of any size are cached under the same key
+        info_str.append("a/");
+    } else {
+        info_str.append(std::to_string(request.metatile_id.width()));
+        info_str.append("/");
+        info_str.append(std::to_string(request.metatile_id.height()));
+        info_str.append("/");
+    }
     if (request.layers) {
         info_str.append("l:");
         for (const std::string& layer_name : *request.layers) {
@@ -108,12 +128,41 @@ static inline bool CheckParams(const TileId& tile_id, ExtensionType ext,
                                const EndpointParams& endpoint_params) noexcept {
     if (!tile_id.Valid()) return false;
     if (ext == ExtensionType::png && endpoint_params.type == EndpointType::mvt) return false;
+    if (ext == ExtensionType::webp && (endpoint_params.type != EndpointType::render ||
+                                          !endpoint_params.webp_encoder)) return false;
     if (ext == ExtensionType::mvt && endpoint_params.type != EndpointType::mvt) return false;
     if (ext == ExtensionType::json && (endpoint_params.type != EndpointType::render ||
                                           !endpoint_params.allow_utf_grid)) return false;
     return true;
 }
 
+// Checks if webp is acceptable according to Accept header (wildcards are ignored)
+static bool AcceptsWebp(const std::string& accept) {
+    std::vector<std::string> media_ranges;
+    util::split(accept, media_ranges, ",");
+    for (const std::string& media_range : media_ranges) {
+        std::vector<std::string> params;
+        util::split(media_range, params, ";");
+        if (params.empty()) {
+            continue;
+        }
+        std::string media_type = params.front();
+        media_type.erase(std::remove_if(media_type.begin(), media_type.end(), ::isspace), media_type.end());
+        if (media_type != "image/webp") {
+            continue;
+        }
+        for (auto param_itr = std::next(params.begin()); param_itr != params.end(); ++param_itr) {
+            std::string param = *param_itr;
+            param.erase(std::remove_if(param.begin(), param.end(), ::isspace), param.end());
+            if (param.compare(0, 2, "q=") == 0 && std::atof(param.data() + 2) <= 0.0) {
+                return false;
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
 static inline bool IsInternalRequest(HTTPMessage& headers, const std::string& internal_port) {
     return headers.getDstPort() == internal_port;
 }
@@ -133,6 +182,16 @@ static optional<folly::SocketAddress> GetRenderNodeAddr(const NodesMonitor& moni
     return addr_entry.sock_addr;
 }
 
+// Node is chosen by metatile of max size for adaptive metatiles, so tile goes to the same node
+// whatever metatile size was chosen for it
+static inline MetatileId GetRoutingMetatileId(const TileRequest& request) {
+    const auto& metatile_sizer = request.endpoint_params->metatile_sizer;
+    if (metatile_sizer) {
+        return MetatileId(request.tile_id, metatile_sizer->max_size());
+    }
+    return request.metatile_id;
+}
+
 TileHandler::TileHandler(const std::string& internal_port,
                          folly::HHWheelTimer& timer,
                          TileProcessingManager& processing_manager,
@@ -276,6 +335,16 @@ void TileHandler::onRequest(std::unique_ptr<HTTPMessage> headers) noexcept {
         return;
     }
 
+    if (endpoint_params.webp_encoder && endpoint_params.type == EndpointType::render) {
+        // Response depends on Accept header for both .png and .webp urls
+        vary_accept_ = true;
+        if (ext_ == ExtensionType::png &&
+                AcceptsWebp(headers_->getHeaders().getSingleOrEmpty(proxygen::HTTP_HEADER_ACCEPT))) {
+            ext_ = ExtensionType::webp;
+        }
+    }
+    tile_request_->ext = ext_;
+
     if (endpoint_params.allow_layers_query) {
         const std::string& requested_layers_param = headers_->getQueryParam("layers");
         if (!requested_layers_param.empty()) {
@@ -283,7 +352,20 @@ void TileHandler::onRequest(std::unique_ptr<HTTPMessage> headers) noexcept {
         }
     }
 
-    if (endpoint_params.auto_metatile_size) {
+    if (endpoint_params.metatile_sizer) {
+        MetatileSizer& metatile_sizer = *endpoint_params.metatile_sizer;
+        uint size_limit = metatile_sizer.max_size();
+        if (endpoint_params.data_provider) {
+            auto max_size = endpoint_params.data_provider->GetMaxMetatileSize(tile_id, endpoint_params.zoom_offset);
+            if (!max_size) {
+                LOG(ERROR) << "Error while computing max metatile size for tile " << tile_id << "!";
+                SendError(500);
+                return;
+            }
+            size_limit = std::min(size_limit, *max_size);
+        }
+        tile_request_->metatile_id = MetatileId(tile_id, metatile_sizer.GetSize(tile_id, size_limit));
+    } else if (endpoint_params.auto_metatile_size) {
         if (!endpoint_params.data_provider) {
             LOG(ERROR) << "Endpoint configured to use auto metatile size, but data provider missing!";
             SendError(500);
@@ -307,7 +389,13 @@ void TileHandler::onRequest(std::unique_ptr<HTTPMessage> headers) noexcept {
         if (!endpoint_params.style_name.empty()) {
             style_version = processing_manager_.render_manager().GetStyleVersion(endpoint_params.style_name);
         }
-        request_info_str_ = MakeRequestInfoStr(*tile_request_, ext_str, style_version);
+        request_info_str_ = MakeRequestInfoStr(*tile_request_, ext_, style_version);
+        if (endpoint_params.utfgrid_with_image && endpoint_params.type == EndpointType::render) {
+            // Other output of combined render is cached under its own key
+            tile_request_->with_utfgrid = true;
+            auto extra_ext = ext_ == ExtensionType::json ? ExtensionType::png : ExtensionType::json;
+            extra_info_str_ = MakeRequestInfoStr(*tile_request_, extra_ext, style_version);
+        }
         is_internal_request_ = IsInternalRequest(*headers_, internal_port_);
         TryLoadFromCache();
     } else {
@@ -327,7 +415,7 @@ void TileHandler::TryLoadFromCache() noexcept {
                 LockCacheAndGenerateTile();
                 return;
             }
-            auto render_addr = GetRenderNodeAddr(*nodes_monitor_, tile_request_->metatile_id);
+            auto render_addr = GetRenderNodeAddr(*nodes_monitor_, GetRoutingMetatileId(*tile_request_));
             if (render_addr) {
                 // Redirect to other render node
                 ProxyToOtherNode(*render_addr);
@@ -348,7 +436,12 @@ void TileHandler::GenerateTile() noexcept {
     assert(tile_request_);
     auto tile_task = std::make_shared<TileProcessingManager::TileTask>([this](Metatile&& metatile) {
         pending_work_.reset();
-        for (Tile& tile : metatile.tiles) {
+        const auto& metatile_sizer = tile_request_->endpoint_params->metatile_sizer;
+        if (metatile_sizer && metatile.render_time.count() > 0) {
+            metatile_sizer->RecordRender(metatile.id, metatile.render_time);
+        }
+        auto& tiles = ext_ == ExtensionType::json ? metatile.utfgrid_tiles : metatile.tiles;
+        for (Tile& tile : tiles) {
             if (tile.id == tile_request_->tile_id) {
                 SendResponse(std::move(tile.data));
                 return;
@@ -424,40 +517,45 @@ void TileHandler::LockCacheAndGenerateTile() {
     auto start_time = std::chrono::system_clock::now();
     auto tile_task = std::make_shared<TileProcessingManager::TileTask>(
             [response_task, cacher_lock, cacher = cacher_, request_info_str = request_info_str_,
-             endpoint_type = tile_request_->endpoint_params->type, tile_id = tile_request_->tile_id, start_time]
+             extra_info_str = extra_info_str_, is_utfgrid = (ext_ == ExtensionType::json),
+             tile_id = tile_request_->tile_id, start_time,
+             metatile_sizer = tile_request_->endpoint_params->metatile_sizer]
                 (Metatile&& metatile) {
         auto stop_time = std::chrono::system_clock::now();
         LOG(INFO) << "Processing of " << metatile.id << " took "
                   << std::chrono::duration_cast<std::chrono::milliseconds>(stop_time - start_time).count();
-        bool response_sent = false;
-        for (Tile& tile : metatile.tiles) {
-            std::string tile_data;
-            if (endpoint_type == EndpointType::mvt) {
-                try {
-                    mapnik::vector_tile_impl::zlib_compress(tile.data, tile_data, true, 5);
-                } catch (const std::runtime_error& e) {
-                    LOG(ERROR) << e.what();
-                    tile_data = std::move(tile.data);
-                }
-            } else {
-                tile_data = std::move(tile.data);
+        if (metatile_sizer && metatile.render_time.count() > 0) {
+            metatile_sizer->RecordRender(metatile.id, metatile.render_time);
+        }
+        auto& tiles = is_utfgrid ? metatile.utfgrid_tiles : metatile.tiles;
+        if (!extra_info_str.empty()) {
+            auto& extra_tiles = is_utfgrid ? metatile.tiles : metatile.utfgrid_tiles;
+            for (Tile& tile : extra_tiles) {
+                auto cached_tile = std::make_shared<CachedTile>(CachedTile{std::move(tile.data)});
+                cacher->Set(MakeCacherKey(tile.id, extra_info_str), cached_tile,
+                            TTLPolicyToSeconds(cached_tile->policy), nullptr);
             }
-
+        }
+        bool response_sent = false;
+        for (Tile& tile : tiles) {
+            // MVT tiles are already compressed by render workers
+            std::string tile_data = std::move(tile.data);
             if (!response_sent && tile.id == tile_id) {
                 response_task->SetResult(tile_data);
                 response_sent = true;
             }
             // TODO: Calculate cache policy
             auto cached_tile = std::make_shared<CachedTile>(CachedTile{std::move(tile_data)});
-            cacher->Set(MakeCacherKey(tile.id, request_info_str), cached_tile,
-                         TTLPolicyToSeconds(cached_tile->policy), nullptr);
+            std::string key = MakeCacherKey(tile.id, request_info_str);
+            cacher_lock->Release(key);
+            cacher->Set(key, cached_tile, TTLPolicyToSeconds(cached_tile->policy), nullptr);
         }
         if (!response_sent) {
             response_task->NotifyError(TileProcessingManager::Error::internal);
-            cacher_lock->Unlock();
-        } else {
-            cacher_lock->Cancel();
         }
+        // Only tiles missing in metatile (e.g. mvt tiles outside of data tile) are left locked,
+        // their waiters get error.
+        cacher_lock->Unlock();
     }, [response_task, cacher_lock](TileProcessingManager::Error err) {
         response_task->NotifyError(err);
         cacher_lock->Unlock();
@@ -480,12 +578,22 @@ void TileHandler::onBody(std::unique_ptr<folly::IOBuf> body) noexcept {/**/}
 void TileHandler::onSuccessEOM() noexcept { }
 
 void TileHandler::SendResponse(std::string tile_data) noexcept {
+    if (solid_tile::IsReference(tile_data)) {
+        auto payload = solid_tile::Resolve(tile_data);
+        if (!payload) {
+            SendError(500);
+            return;
+        }
+        tile_data = *payload;
+    }
     proxygen::ResponseBuilder rb(downstream_);
     rb.status(200, "OK");
     rb.header("Pragma", "public");
     rb.header("Cache-Control", "max-age=86400");
     if (ext_ == ExtensionType::png) {
         rb.header("Content-Type", "image/png");
+    } else if (ext_ == ExtensionType::webp) {
+        rb.header("Content-Type", "image/webp");
     } else if (ext_ == ExtensionType::mvt) {
         rb.header("Content-Type", "application/x-protobuf");
         if (mapnik::vector_tile_impl::is_gzip_compressed(tile_data)) {
@@ -496,6 +604,9 @@ void TileHandler::SendResponse(std::string tile_data) noexcept {
     } else if (ext_ == ExtensionType::html) {
         rb.header("Content-Type", "text/html");
     }
+    if (vary_accept_) {
+        rb.header("Vary", "Accept");
+    }
     rb.header("access-control-allow-origin", "*");
     // DBG
     rb.header("dbg-node-port", internal_port_);
@@ -75,6 +75,8 @@ private:
     std::shared_ptr<TileRequest> tile_request_;
     std::shared_ptr<AsyncTaskBase> pending_work_;
     std::string request_info_str_;
+    // Cache info of the second output of combined image and utfgrid render
+    std::string extra_info_str_;
     std::string buffer_;
     std::string internal_port_;
     util::ExtensionType ext_{util::ExtensionType::none};
@@ -82,6 +84,7 @@ private:
     bool is_internal_request_{false};
     bool extra_timeout_{false};
     bool headers_sent_{false};
+    bool vary_accept_{false};
 
     friend class ProxyHandler;
 };
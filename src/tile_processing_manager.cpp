@@ -135,14 +135,37 @@ void TileProcessor::ProcessRender() {
     auto render_request = std::make_unique<RenderRequest>(tile_request_->metatile_id);
     render_request->style_name = endpoint_params.style_name;
     render_request->data_tile = std::move(data_tile_);
+    if (endpoint_params.data_provider) {
+        render_request->data_key = endpoint_params.data_provider->name() + '/' + tile_request_->data_version;
+    }
     render_request->retina = tile_request_->tags.find("retina") != tile_request_->tags.end();
+    if (tile_request_->with_utfgrid) {
+        render_request->render_type = RenderType::png_utfgrid;
+    } else if (tile_request_->ext == util::ExtensionType::json) {
+        render_request->render_type = RenderType::utfgrid;
+    }
+    if (render_request->render_type != RenderType::png) {
+        render_request->utfgrid_key = endpoint_params.utfgrid_key;
+    }
+    if (tile_request_->ext == util::ExtensionType::webp) {
+        render_request->tile_encoder = endpoint_params.webp_encoder;
+    } else {
+        render_request->tile_encoder = endpoint_params.tile_encoder;
+    }
+    // Render is aborted if tile task is cancelled, e.g. when client disconnects and result is not cached
     pending_work_ = render_manager_.Render(std::move(render_request),
                                std::bind(&TileProcessor::OnRenderSuccess, this, std::placeholders::_1),
-                               std::bind(&TileProcessor::OnRenderError, this));
+                               std::bind(&TileProcessor::OnRenderError, this),
+                               tile_task_);
 }
 
 void TileProcessor::ProcessMvt() {
     auto subtile_request = std::make_unique<SubtileRequest>(std::move(*data_tile_), tile_request_->tile_id);
+    subtile_request->metatile_id = tile_request_->metatile_id;
+    if (tile_request_->endpoint_params->data_provider) {
+        subtile_request->data_key = tile_request_->endpoint_params->data_provider->name() + '/' +
+                tile_request_->data_version;
+    }
     subtile_request->filter_table = tile_request_->endpoint_params->filter_table;
     subtile_request->layers = std::move(tile_request_->layers);
 
@@ -7,6 +7,7 @@
 #include "async_task.h"
 #include "endpoint.h"
 #include "tile.h"
+#include "util.h"
 
 
 struct TileRequest {
@@ -16,6 +17,10 @@ struct TileRequest {
     std::shared_ptr<EndpointParams> endpoint_params;
     std::unique_ptr<std::set<std::string>> layers;
     std::string data_version;
+    // Requested tile format (after content negotiation)
+    util::ExtensionType ext{util::ExtensionType::none};
+    // Render utfgrid and image together
+    bool with_utfgrid{false};
 };
 
 
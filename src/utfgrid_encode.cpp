@@ -1,87 +1,164 @@
 #include "utfgrid_encode.h"
 
+#include <cmath>
+#include <cstdio>
 #include <unordered_map>
 
 #include <glog/logging.h>
-#include <jsoncpp/json/value.h>
 #include <mapnik/unicode.hpp>
 
+
+namespace {
+
+// Appends string as JSON string literal
+void AppendJsonString(std::string& out, const std::string& str) {
+    static const char hex_digits[] = "0123456789abcdef";
+    out.push_back('"');
+    for (char c : str) {
+        switch (c) {
+        case '"': out.append("\\\""); break;
+        case '\\': out.append("\\\\"); break;
+        case '\n': out.append("\\n"); break;
+        case '\r': out.append("\\r"); break;
+        case '\t': out.append("\\t"); break;
+        case '\b': out.append("\\b"); break;
+        case '\f': out.append("\\f"); break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                out.append("\\u00");
+                out.push_back(hex_digits[(c >> 4) & 0xf]);
+                out.push_back(hex_digits[c & 0xf]);
+            } else {
+                out.push_back(c);
+            }
+        }
+    }
+    out.push_back('"');
+}
+
+// Appends codepoint of BMP as UTF-8
+inline void AppendCodepoint(std::string& out, std::uint32_t codepoint) {
+    if (codepoint < 0x80) {
+        out.push_back(static_cast<char>(codepoint));
+    } else if (codepoint < 0x800) {
+        out.push_back(static_cast<char>(0xc0 | (codepoint >> 6)));
+        out.push_back(static_cast<char>(0x80 | (codepoint & 0x3f)));
+    } else {
+        out.push_back(static_cast<char>(0xe0 | (codepoint >> 12)));
+        out.push_back(static_cast<char>(0x80 | ((codepoint >> 6) & 0x3f)));
+        out.push_back(static_cast<char>(0x80 | (codepoint & 0x3f)));
+    }
+}
+
 struct value_to_json_visitor {
-    Json::Value operator() (const mapnik::value_null& val) {return Json::Value();}
-    Json::Value operator() (const mapnik::value_bool& val) {return Json::Value(val);}
-    Json::Value operator() (const mapnik::value_integer& val) {return Json::Value(static_cast<uint>(val));}
-    Json::Value operator() (const mapnik::value_double& val) {return Json::Value(val);}
+    std::string& out;
+
+    void operator() (const mapnik::value_null&) {out.append("null");}
+    void operator() (const mapnik::value_bool& val) {out.append(val ? "true" : "false");}
+    void operator() (const mapnik::value_integer& val) {out.append(std::to_string(val));}
+
+    void operator() (const mapnik::value_double& val) {
+        if (!std::isfinite(val)) {
+            out.append("null");
+            return;
+        }
+        char buf[32];
+        int len = std::snprintf(buf, sizeof(buf), "%.17g", val);
+        out.append(buf, len);
+    }
 
-    Json::Value operator() (const mapnik::value_unicode_string& val) {
+    void operator() (const mapnik::value_unicode_string& val) {
         std::string utf8_str;
         mapnik::to_utf8(val, utf8_str);
-        return Json::Value(utf8_str);
+        AppendJsonString(out, utf8_str);
     }
 };
 
-std::string encode_utfgrid(const mapnik::grid_view& utfgrid, uint size) {
-    Json::Value root(Json::objectValue);
-    Json::Value& jgrid = root["grid"];
-    jgrid = Json::Value(Json::arrayValue);
+} // namespace
+
 
+std::string encode_utfgrid(const mapnik::grid_view& utfgrid, uint size) {
     using lookup_type = mapnik::grid::lookup_type;
     using value_type = mapnik::grid::value_type;
     using feature_type = mapnik::grid::feature_type;
-    using keys_type = std::unordered_map<lookup_type, value_type>;
+
+    const mapnik::grid::feature_key_type& feature_keys = utfgrid.get_feature_keys();
 
     std::vector<lookup_type> key_order;
-    keys_type keys;
+    // Codepoints by key, and by pixel value to avoid key lookups of known features
+    std::unordered_map<lookup_type, std::uint32_t> keys;
+    std::unordered_map<value_type, std::uint32_t> ids;
 
-    const mapnik::grid::feature_key_type& feature_keys = utfgrid.get_feature_keys();
+    const uint width = (utfgrid.width() + size - 1) / size;
+    const uint height = (utfgrid.height() + size - 1) / size;
 
-    std::uint16_t codepoint = 32;
+    std::string out;
+    // Most of grid codepoints are ASCII
+    out.reserve(16 + height * (width + 3));
+    out.append("{\"grid\":[");
+
+    std::uint32_t next_codepoint = 32;
     for (uint y = 0; y < utfgrid.height(); y += size) {
-        std::string line;
+        if (y != 0) {
+            out.push_back(',');
+        }
+        out.push_back('"');
         const value_type* row = utfgrid.get_row(y);
+        bool has_last = false;
+        value_type last_id = 0;
+        std::uint32_t codepoint = 0;
         for (uint x = 0; x < utfgrid.width(); x += size) {
-            value_type feature_id = row[x];
-            auto feature_itr = feature_keys.find(feature_id);
-            lookup_type val;
-            if (feature_itr == feature_keys.end()) {
-                feature_id = mapnik::grid::base_mask;
-            } else {
-                val = feature_itr->second;
-            }
-            auto key_iter = keys.find(val);
-            if (key_iter == keys.end()) {
-                // Create a new entry for this key. Skip the codepoints that
-                // can't be encoded directly in JSON.
-                if (codepoint == 34) ++codepoint;      // Skip "
-                else if (codepoint == 92) ++codepoint; // Skip backslash
-                if (feature_id == mapnik::grid::base_mask) {
-                    keys[""] = codepoint;
-                    key_order.push_back("");
+            const value_type feature_id = row[x];
+            // Features cover runs of pixels, so previous lookup is reused
+            if (!has_last || feature_id != last_id) {
+                auto id_itr = ids.find(feature_id);
+                if (id_itr != ids.end()) {
+                    codepoint = id_itr->second;
                 } else {
-                    keys[val] = codepoint;
-                    key_order.push_back(val);
+                    auto feature_itr = feature_keys.find(feature_id);
+                    const lookup_type key = feature_itr == feature_keys.end() ? lookup_type() : feature_itr->second;
+                    auto key_itr = keys.find(key);
+                    if (key_itr != keys.end()) {
+                        codepoint = key_itr->second;
+                    } else {
+                        // Skip the codepoints that can't be encoded directly in JSON,
+                        // and surrogates which are not valid codepoints.
+                        if (next_codepoint == 34) ++next_codepoint;      // Skip "
+                        else if (next_codepoint == 92) ++next_codepoint; // Skip backslash
+                        else if (next_codepoint == 0xd800) next_codepoint = 0xe000;
+                        if (next_codepoint > 0xffff) {
+                            LOG(WARNING) << "Too many features in utfgrid, some of them are merged";
+                            next_codepoint = 0xffff;
+                        }
+                        codepoint = next_codepoint++;
+                        keys.emplace(key, codepoint);
+                        key_order.push_back(key);
+                    }
+                    ids.emplace(feature_id, codepoint);
                 }
-                line.append(reinterpret_cast<char*>(&codepoint), sizeof(codepoint));
-                ++codepoint;
-            } else {
-                line.append(reinterpret_cast<char*>(&key_iter->second), sizeof(key_iter->second));
+                last_id = feature_id;
+                has_last = true;
             }
+            AppendCodepoint(out, codepoint);
         }
-        jgrid.append(Json::Value(line));
+        out.push_back('"');
     }
 
-    Json::Value& jkeys = root["keys"];
-    jkeys = Json::Value(Json::arrayValue);
-    for (const auto& key_id : key_order) {
-        jkeys.append(key_id);
+    out.append("],\"keys\":[");
+    for (std::size_t i = 0; i < key_order.size(); ++i) {
+        if (i != 0) {
+            out.push_back(',');
+        }
+        AppendJsonString(out, key_order[i]);
     }
 
-    Json::Value& jdata = root["data"];
-
+    out.append("],\"data\":{");
     const feature_type& g_features = utfgrid.get_grid_features();
     const std::set<std::string>& attributes = utfgrid.get_fields();
     feature_type::const_iterator feat_end = g_features.end();
-    for (const std::string& key_item : key_order)
-    {
+    value_to_json_visitor val_to_json{out};
+    bool first_feature = true;
+    for (const std::string& key_item : key_order) {
         if (key_item.empty()) {
             continue;
         }
@@ -91,23 +168,44 @@ std::string encode_utfgrid(const mapnik::grid_view& utfgrid, uint size) {
             continue;
         }
 
+        // Feature is written only if it has any attribute, so it is rolled back otherwise
+        const std::size_t feature_start = out.size();
+        if (!first_feature) {
+            out.push_back(',');
+        }
+        AppendJsonString(out, feat_itr->first);
+        out.append(":{");
+
         bool found = false;
-        Json::Value jfeature(Json::objectValue);
-        mapnik::feature_ptr feature = feat_itr->second;
+        bool first_attr = true;
+        const mapnik::feature_ptr& feature = feat_itr->second;
         for (const std::string& attr : attributes) {
-            value_to_json_visitor val_to_json;
-            if (attr == "__id__") {
-                jfeature[attr] = static_cast<uint>(feature->id());
-            } else if (feature->has_key(attr)) {
+            const bool is_id = attr == "__id__";
+            if (!is_id && !feature->has_key(attr)) {
+                continue;
+            }
+            if (!first_attr) {
+                out.push_back(',');
+            }
+            first_attr = false;
+            AppendJsonString(out, attr);
+            out.push_back(':');
+            if (is_id) {
+                out.append(std::to_string(feature->id()));
+            } else {
                 found = true;
-                jfeature[attr] = mapnik::util::apply_visitor(val_to_json, feature->get(attr));
+                mapnik::util::apply_visitor(val_to_json, feature->get(attr));
             }
         }
+        out.push_back('}');
 
         if (found) {
-            jdata[feat_itr->first] = jfeature;
+            first_feature = false;
+        } else {
+            out.resize(feature_start);
         }
     }
+    out.append("}}");
 
-    return root.toStyledString();
+    return out;
 }
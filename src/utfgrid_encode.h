@@ -4,5 +4,6 @@
 
 #include <mapnik/grid/grid.hpp>
 
-std::string encode_utfgrid(const mapnik::grid_view& utfgrid, uint size = 4);
+// Encodes every size-th pixel of grid. Grids are rendered at output resolution, so all pixels are encoded by default.
+std::string encode_utfgrid(const mapnik::grid_view& utfgrid, uint size = 1);
 
@@ -30,6 +30,8 @@ ExtensionType str2ext(std::string& ext) {
         return ExtensionType::mvt;
     else if (ext == "json")
         return ExtensionType::json;
+    else if (ext == "webp")
+        return ExtensionType::webp;
     return ExtensionType::none;
 
 }
@@ -39,6 +41,7 @@ std::string ext2str(ExtensionType aExt) {
     case ExtensionType::json: { return "json"; } break;
     case ExtensionType::mvt: { return "mvt"; } break;
     case ExtensionType::png: { return "png"; } break;
+    case ExtensionType::webp: { return "webp"; } break;
     default:
         return "unknown";
     }
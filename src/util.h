@@ -132,6 +132,7 @@ enum class ExtensionType {
     mvt,
     json,
     html,
+    webp,
 };
 
 ExtensionType str2ext(std::string& ext);